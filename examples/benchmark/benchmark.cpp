@@ -107,9 +107,7 @@ int main()
 	parser.pid_reset();
 	
 	// add a callback function that will be used for PASs
-	heap.psi_callback([&](const tssi::section_identifier si) {
-		if (get<0>(si) != 0x00)
-			return;
+	heap.psi_callback(0x00, 0x00, [&](const tssi::section_identifier si) {
 		// PAT -> PMT
 		using namespace tssi::iso138181::program_association_section;
 		auto& psi_data = heap.psi_heap(); // the data we have (all of it)
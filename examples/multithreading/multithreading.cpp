@@ -58,16 +58,12 @@ int main() {
 			{
 				auto lock = heap->lock_shared();	
 				event_count = 0;
-				for (auto& section : psi_data) {
-					if (get<0>(section.first) >= 0x4e && get<0>(section.first) <= 0x6f) { // eit table id?
-
-						if (section.second.crc32()) {
-							auto data = section.second.psi_data();
-							for (auto loop : event_info_loop(data)) {
-								++event_count;
-							}
+				for (auto& section : psi_data.table_range(0x4e, 0x6f)) { // eit table ids only
+					if (section.second.crc32()) {
+						auto data = section.second.psi_data();
+						for (auto loop : event_info_loop(data)) {
+							++event_count;
 						}
-
 					}
 				}
 				
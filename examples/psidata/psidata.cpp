@@ -257,7 +257,7 @@ void write_descriptors(ofstream& f, range_span<descriptor_loop::size> range)
 
 
 
-void write_pat(ofstream& f, const map<section_identifier, PSISection<>>& heap)
+void write_pat(ofstream& f, const PSIStore<>& heap)
 {
 
 	html_table t(f, u8"Program Association Table (PAT)");
@@ -282,7 +282,7 @@ void write_pat(ofstream& f, const map<section_identifier, PSISection<>>& heap)
 }
 
 
-void write_nit(ofstream& f, const map<section_identifier, PSISection<>>& heap)
+void write_nit(ofstream& f, const PSIStore<>& heap)
 {
 	html_table t(f, u8"Network Information Table (NIT)");
 	using namespace etsi300468::network_information_section;
@@ -311,7 +311,7 @@ void write_nit(ofstream& f, const map<section_identifier, PSISection<>>& heap)
 	}
 }
 
-void write_bat(ofstream& f, const map<section_identifier, PSISection<>>& heap)
+void write_bat(ofstream& f, const PSIStore<>& heap)
 {
 	html_table t(f, u8"Bouquet Association Table (BAT)");
 	using namespace etsi300468::bouquet_association_section;
@@ -340,7 +340,7 @@ void write_bat(ofstream& f, const map<section_identifier, PSISection<>>& heap)
 }
 
 
-void write_sdt(ofstream& f, const map<section_identifier, PSISection<>>& heap)
+void write_sdt(ofstream& f, const PSIStore<>& heap)
 {
 	html_table t(f, u8"Service Description Table (SDT)");
 	using namespace etsi300468::service_description_section;
@@ -373,7 +373,7 @@ void write_sdt(ofstream& f, const map<section_identifier, PSISection<>>& heap)
 	}
 }
 
-void write_pmt(ofstream& f, const map<section_identifier, PSISection<>>& heap)
+void write_pmt(ofstream& f, const PSIStore<>& heap)
 {
 	html_table t(f, u8"Program Map Table (PMT)");
 	using namespace iso138181::TS_program_map_section;
@@ -401,7 +401,7 @@ void write_pmt(ofstream& f, const map<section_identifier, PSISection<>>& heap)
 	}
 }
 
-void write_tsdt(ofstream& f, const map<section_identifier, PSISection<>>& heap)
+void write_tsdt(ofstream& f, const PSIStore<>& heap)
 {
 	html_table t(f, u8"Transport Stream Description Table (TSDT)");
 	using namespace iso138181::TS_description_section;
@@ -418,7 +418,7 @@ void write_tsdt(ofstream& f, const map<section_identifier, PSISection<>>& heap)
 	}
 }
 
-void write_tdt(ofstream& f, const map<section_identifier, PSISection<>>& heap)
+void write_tdt(ofstream& f, const PSIStore<>& heap)
 {
 	html_table t(f, u8"Time Date Table (TDT)");
 	using namespace etsi300468::time_date_section;
@@ -437,7 +437,7 @@ void write_tdt(ofstream& f, const map<section_identifier, PSISection<>>& heap)
 }
 
 
-void write_tot(ofstream& f, const map<section_identifier, PSISection<>>& heap)
+void write_tot(ofstream& f, const PSIStore<>& heap)
 {
 	html_table t(f, u8"Time Offset Table (TOT)");
 	using namespace etsi300468::time_offset_section;
@@ -455,7 +455,7 @@ void write_tot(ofstream& f, const map<section_identifier, PSISection<>>& heap)
 	}
 }
 
-void write_rst(ofstream& f, const map<section_identifier, PSISection<>>& heap)
+void write_rst(ofstream& f, const PSIStore<>& heap)
 {
 	html_table t(f, u8"Running Status Table (RST)");
 	using namespace etsi300468::running_status_section;
@@ -478,7 +478,7 @@ void write_rst(ofstream& f, const map<section_identifier, PSISection<>>& heap)
 	}
 }
 
-void write_eit(ofstream& f, const map<section_identifier, PSISection<>>& heap, bool small_table)
+void write_eit(ofstream& f, const PSIStore<>& heap, bool small_table)
 {
 	html_table t(f, u8"Event information table (EIT)");
 	using namespace etsi300468::event_information_section;
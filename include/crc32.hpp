@@ -0,0 +1,204 @@
+/*++
+*    tssi - A library for parsing MPEG-2 and DVB Transport Streams
+*
+*    Copyright (C) 2017 Martin Hoernig (goforcode.com)
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+--*/
+
+#pragma once
+
+#include <cstdint>
+#include <gsl/span>
+
+#if !defined(TSSI_NO_PCLMUL) && (defined(__x86_64__) || defined(_M_X64))
+#define TSSI_PCLMUL
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TSSI_TARGET_PCLMUL
+#else // _MSC_VER
+#include <cpuid.h>
+#define TSSI_TARGET_PCLMUL __attribute__((target("pclmul,ssse3")))
+#endif // _MSC_VER
+#endif
+
+namespace tssi
+{
+
+/****c* tssi/crc32_engine
+*  NAME
+*    crc32_engine -- CRC-32 as defined for PSI sections (ISO/IEC 13818-1 Annex A,
+*    polynomial 0x04c11db7, no reflection, no final xor). Buffers are processed
+*    eight bytes per iteration (slicing-by-8). On x86-64 processors supporting
+*    PCLMULQDQ, larger buffers are folded by carry-less multiplication instead. The
+*    path is chosen at runtime. Define TSSI_NO_PCLMUL to disable the latter.
+*  NOTES
+*    Use crc32_mpeg2 for convenience.
+*  METHODS
+*    update
+*****/
+template <class T = void>
+class crc32_engine {
+public:
+	/****m* crc32_engine/update
+	*  NAME
+	*    update -- Continues the CRC calculation of crc with data. Start with
+	*    0xffffffff. A section including its CRC_32 field is valid if the result is 0.
+	*    To generate a section, calculate the CRC of all bytes preceding CRC_32 and
+	*    store the result in big-endian order.
+	*  SYNOPSIS
+	*/
+	static uint_fast32_t update(gsl::span<const char> data, uint_fast32_t crc = 0xffffffff) noexcept
+	/*******/
+	{
+#ifdef TSSI_PCLMUL
+		if (data.size() >= 64 && pclmul_supported())
+			return update_pclmul(data, crc);
+#endif // TSSI_PCLMUL
+		return update_table(data, crc);
+	}
+
+private:
+	struct slice_tables {
+		uint_least32_t table[8][256];
+
+		constexpr slice_tables() : table() {
+			for (uint_fast32_t i = 0; i < 256; ++i) {
+				uint_fast32_t crc = i << 24;
+				for (int bit = 0; bit < 8; ++bit)
+					crc = (crc & 0x80000000) ? ((crc << 1) ^ 0x04c11db7) & 0xffffffff : (crc << 1) & 0xffffffff;
+				table[0][i] = static_cast<uint_least32_t>(crc);
+			}
+			for (uint_fast32_t i = 0; i < 256; ++i) {
+				for (int slice = 1; slice < 8; ++slice) {
+					const uint_fast32_t previous = table[slice - 1][i];
+					table[slice][i] = static_cast<uint_least32_t>(((previous << 8) & 0xffffffff) ^ table[0][previous >> 24]);
+				}
+			}
+		}
+	};
+
+	static constexpr slice_tables tables{};
+
+	static uint_fast32_t byte_at(const char* p, size_t i) noexcept
+	{
+		return static_cast<unsigned char>(p[i]);
+	}
+
+	static uint_fast32_t update_table(gsl::span<const char> data, uint_fast32_t crc) noexcept
+	{
+		const auto& t = tables.table;
+		const char* p = data.data();
+		size_t n = static_cast<size_t>(data.size());
+
+		while (n >= 8) {
+			crc ^= (byte_at(p, 0) << 24) | (byte_at(p, 1) << 16) | (byte_at(p, 2) << 8) | byte_at(p, 3);
+			crc = t[7][crc >> 24] ^ t[6][(crc >> 16) & 0xff] ^ t[5][(crc >> 8) & 0xff] ^ t[4][crc & 0xff] ^
+				t[3][byte_at(p, 4)] ^ t[2][byte_at(p, 5)] ^ t[1][byte_at(p, 6)] ^ t[0][byte_at(p, 7)];
+			p += 8;
+			n -= 8;
+		}
+		while (n > 0) {
+			crc = ((crc << 8) & 0xffffffff) ^ t[0][(crc >> 24) ^ byte_at(p, 0)];
+			++p;
+			--n;
+		}
+		return crc;
+	}
+
+#ifdef TSSI_PCLMUL
+	// x^n mod P
+	static constexpr uint_fast64_t x_mod_p(unsigned n) noexcept
+	{
+		uint_fast64_t remainder = 1;
+		for (unsigned i = 0; i < n; ++i) {
+			remainder <<= 1;
+			if (remainder & 0x100000000)
+				remainder ^= 0x104c11db7;
+		}
+		return remainder;
+	}
+
+	static bool pclmul_supported() noexcept
+	{
+		static const bool supported = []() {
+			unsigned int ecx = 0;
+#ifdef _MSC_VER
+			int info[4];
+			__cpuid(info, 1);
+			ecx = static_cast<unsigned int>(info[2]);
+#else // _MSC_VER
+			unsigned int eax, ebx, edx;
+			if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+				return false;
+#endif // _MSC_VER
+			return (ecx & (1 << 1)) != 0 && (ecx & (1 << 9)) != 0; // PCLMULQDQ, SSSE3
+		}();
+		return supported;
+	}
+
+	// Folds the buffer into a single 128 bit block that is congruent to the buffer
+	// modulo P, then finishes the block and the remaining bytes by table.
+	TSSI_TARGET_PCLMUL
+	static uint_fast32_t update_pclmul(gsl::span<const char> data, uint_fast32_t crc) noexcept
+	{
+		const __m128i reverse = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+		const __m128i constants = _mm_set_epi64x(
+			static_cast<long long>(x_mod_p(192)), static_cast<long long>(x_mod_p(128)));
+
+		const char* p = data.data();
+		size_t n = static_cast<size_t>(data.size());
+
+		// bit i of the register is the coefficient of x^i
+		__m128i block = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)), reverse);
+		block = _mm_xor_si128(block, _mm_set_epi32(static_cast<int>(crc), 0, 0, 0));
+		p += 16;
+		n -= 16;
+
+		while (n >= 16) {
+			const __m128i high = _mm_clmulepi64_si128(block, constants, 0x11); // * x^192
+			const __m128i low = _mm_clmulepi64_si128(block, constants, 0x00); // * x^128
+			block = _mm_xor_si128(_mm_xor_si128(high, low),
+				_mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)), reverse));
+			p += 16;
+			n -= 16;
+		}
+
+		alignas(16) char folded[16];
+		_mm_store_si128(reinterpret_cast<__m128i*>(folded), _mm_shuffle_epi8(block, reverse));
+
+		crc = update_table(folded, 0);
+		return update_table(gsl::span<const char>(p, static_cast<std::ptrdiff_t>(n)), crc);
+	}
+#endif // TSSI_PCLMUL
+
+};
+
+template <class T>
+constexpr typename crc32_engine<T>::slice_tables crc32_engine<T>::tables;
+
+/****f* tssi/crc32_mpeg2
+*  NAME
+*    crc32_mpeg2 -- Calculates the CRC-32 of PSI sections (see crc32_engine).
+*  SYNOPSIS
+*/
+inline uint_fast32_t crc32_mpeg2(gsl::span<const char> data, uint_fast32_t crc = 0xffffffff) noexcept
+/*******/
+{
+	return crc32_engine<>::update(data, crc);
+}
+
+}
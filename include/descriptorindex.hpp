@@ -0,0 +1,242 @@
+/*++
+*    tssi - A library for parsing MPEG-2 and DVB Transport Streams
+*
+*    Copyright (C) 2017 Martin Hoernig (goforcode.com)
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+--*/
+
+#pragma once
+
+#include <array>
+#include <algorithm>
+#include <vector>
+#include "specifications.hpp"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif // _MSC_VER
+
+namespace tssi
+{
+
+/****c* tssi/DescriptorIndex
+*  NAME
+*    DescriptorIndex -- Index of the descriptor loops of a section: which descriptor
+*    tags a loop contains and where the first descriptor of each tag starts. Built
+*    in a single pass, lookups take constant time.
+*  NOTES
+*    Loops are numbered in order of appearance:
+*    - conditional_access_section, TS_description_section, time_offset_section:
+*      0 is the descriptor loop of the section
+*    - TS_program_map_section: 0 is the program info loop, i + 1 the loop of the
+*      i-th elementary stream
+*    - network_information_section, bouquet_association_section: 0 is the network
+*      or bouquet loop, i + 1 the loop of the i-th transport stream
+*    - service_description_section: i is the loop of the i-th service
+*    - event_information_section: i is the loop of the i-th event
+*    Loops of other tables are not indexed. Offsets are relative to the start of
+*    the section, so the index stays valid for every copy of the section data.
+*    PSIHeap builds the index of completed sections on request, see
+*    heap_descriptor_index and PSISection/descriptor_index.
+*  METHODS
+*    index_loops
+*    index_loop
+*    index_has
+*    index_offset
+*    index_find
+*****/
+class DescriptorIndex {
+public:
+	DescriptorIndex() = default;
+
+	explicit DescriptorIndex(gsl::span<const char> section)
+	{
+		if (section.size() < 12)
+			return;
+		const ptrdiff_t end = section.size() - 4; // CRC_32
+		const auto table_id = static_cast<uint8_t>(section[0]);
+
+		if (table_id == 0x01 || table_id == 0x03)
+			add_loop(section, 8, end - 8);
+		else if (table_id == 0x02) {
+			const auto program_info = length12(section, 10);
+			if (add_loop(section, 12, program_info))
+				add_entries(section, 12 + program_info, end, 5, 3);
+		}
+		else if (table_id == 0x40 || table_id == 0x41 || table_id == 0x4a) {
+			const auto descriptors = length12(section, 8);
+			if (add_loop(section, 10, descriptors) && 12 + descriptors <= end) {
+				const auto transport_streams = length12(section, 10 + descriptors);
+				add_entries(section, 12 + descriptors, std::min(end, 12 + descriptors + transport_streams), 6, 4);
+			}
+		}
+		else if (table_id == 0x42 || table_id == 0x46)
+			add_entries(section, 11, end, 5, 3);
+		else if (table_id >= 0x4e && table_id <= 0x6f)
+			add_entries(section, 14, end, 12, 10);
+		else if (table_id == 0x73)
+			add_loop(section, 10, length12(section, 8));
+	}
+
+	/****m* DescriptorIndex/index_loops
+	*  NAME
+	*    index_loops -- Returns the number of descriptor loops indexed.
+	*  SYNOPSIS
+	*/
+	size_t index_loops() const noexcept
+	/*******/
+	{ return loops.size(); }
+
+	/****m* DescriptorIndex/index_loop
+	*  NAME
+	*    index_loop -- Returns the descriptor loop number loop of section.
+	*  SYNOPSIS
+	*/
+	gsl::span<const char> index_loop(gsl::span<const char> section, size_t loop) const
+	/*******/
+	{
+		Expects(loop < loops.size());
+		return section.subspan(loops[loop].offset, loops[loop].length);
+	}
+
+	/****m* DescriptorIndex/index_has
+	*  NAME
+	*    index_has -- Returns true if the descriptor loop number loop contains a
+	*    descriptor with descriptor_tag tag.
+	*  SYNOPSIS
+	*/
+	bool index_has(size_t loop, uint_fast8_t tag) const noexcept
+	/*******/
+	{ return loop < loops.size() && (loops[loop].tags[tag >> 6] >> (tag & 0x3f)) & 0x1; }
+
+	/****m* DescriptorIndex/index_offset
+	*  NAME
+	*    index_offset -- Returns the offset of the first descriptor with descriptor_tag
+	*    tag in the descriptor loop number loop, relative to the start of the
+	*    section, or -1.
+	*  SYNOPSIS
+	*/
+	ptrdiff_t index_offset(size_t loop, uint_fast8_t tag) const noexcept
+	/*******/
+	{
+		if (!index_has(loop, tag))
+			return -1;
+		return offsets[loops[loop].first + rank(loops[loop].tags, tag)];
+	}
+
+	/****m* DescriptorIndex/index_find
+	*  NAME
+	*    index_find -- Returns the first descriptor with descriptor_tag tag in the
+	*    descriptor loop number loop of section, or an empty span, e.g.
+	*      auto d = index.index_find(section, 0, 0x4d); // short_event_descriptor
+	*  DATA SCOPE
+	*    descriptor_loop
+	*  SYNOPSIS
+	*/
+	gsl::span<const char> index_find(gsl::span<const char> section, size_t loop, uint_fast8_t tag) const
+	/*******/
+	{
+		const auto offset = index_offset(loop, tag);
+		if (offset < 0)
+			return gsl::span<const char>();
+		return section.subspan(offset, descriptor_loop::size(section.subspan(offset)));
+	}
+
+private:
+	using tag_mask = std::array<uint_least64_t, 4>;
+
+	struct loop_entry {
+		uint_least16_t	offset;
+		uint_least16_t	length;
+		uint_least32_t	first; // in offsets
+		tag_mask		tags{};
+	};
+
+	static ptrdiff_t length12(gsl::span<const char> section, ptrdiff_t position) noexcept
+	{
+		return (static_cast<ptrdiff_t>(static_cast<uint8_t>(section[position]) & 0x0f) << 8) |
+			static_cast<uint8_t>(section[position + 1]);
+	}
+
+	static unsigned popcount(uint_least64_t bits) noexcept
+	{
+#ifdef _MSC_VER
+		return static_cast<unsigned>(__popcnt64(bits));
+#else // _MSC_VER
+		return static_cast<unsigned>(__builtin_popcountll(bits));
+#endif // _MSC_VER
+	}
+
+	// number of tags in mask below tag
+	static size_t rank(const tag_mask& mask, uint_fast8_t tag) noexcept
+	{
+		size_t n = 0;
+		for (size_t i = 0; i < static_cast<size_t>(tag >> 6); ++i)
+			n += popcount(mask[i]);
+		const auto low = tag & 0x3f;
+		if (low > 0)
+			n += popcount(mask[tag >> 6] & ((uint_least64_t(1) << low) - 1));
+		return n;
+	}
+
+	// indexes the descriptors in section from offset, returns false if the loop is truncated
+	bool add_loop(gsl::span<const char> section, ptrdiff_t offset, ptrdiff_t length)
+	{
+		if (offset + length > section.size() - 4)
+			return false;
+
+		loop_entry loop;
+		loop.offset = static_cast<uint_least16_t>(offset);
+		loop.length = static_cast<uint_least16_t>(length);
+		loop.first = static_cast<uint_least32_t>(offsets.size());
+
+		const auto end = offset + length;
+		for (auto position = offset; position + 2 <= end; ) {
+			const auto tag = static_cast<uint8_t>(section[position]);
+			const auto size = 2 + static_cast<ptrdiff_t>(static_cast<uint8_t>(section[position + 1]));
+			if (position + size > end)
+				break; // truncated descriptor
+			auto& word = loop.tags[tag >> 6];
+			const auto bit = uint_least64_t(1) << (tag & 0x3f);
+			if (!(word & bit)) {
+				// keep the offsets of a loop ordered by tag
+				const auto at = offsets.begin() + loop.first + rank(loop.tags, tag);
+				offsets.insert(at, static_cast<uint_least16_t>(position));
+				word |= bit;
+			}
+			position += size;
+		}
+
+		loops.push_back(loop);
+		return true;
+	}
+
+	// indexes the loops of entries from start to end, stops at the first truncated entry
+	void add_entries(gsl::span<const char> section, ptrdiff_t start, ptrdiff_t end, ptrdiff_t fixed, ptrdiff_t length)
+	{
+		for (auto position = start; position + fixed <= end; ) {
+			const auto descriptors = length12(section, position + length);
+			if (position + fixed + descriptors > end || !add_loop(section, position + fixed, descriptors))
+				break;
+			position += fixed + descriptors;
+		}
+	}
+
+	std::vector<loop_entry>		loops;
+	std::vector<uint_least16_t>	offsets; // of the first descriptor per tag and loop, ordered by tag
+};
+
+}
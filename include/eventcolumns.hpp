@@ -0,0 +1,164 @@
+/*++
+*    tssi - A library for parsing MPEG-2 and DVB Transport Streams
+*
+*    Copyright (C) 2017 Martin Hoernig (goforcode.com)
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+--*/
+
+#pragma once
+
+#include <algorithm>
+#include <vector>
+#include <ctime>
+#include "specifications.hpp"
+
+namespace tssi
+{
+
+/****t* tssi/event_columns
+*  NAME
+*    event_columns -- Events of event information sections, one column per field
+*    (struct of arrays). Row i describes the i-th event extracted:
+*    - section: index into sections, the section carrying the event
+*    - table_id, service_id, transport_stream_id, original_network_id: of the section
+*    - event_id, duration (seconds), running_status, free_CA_mode
+*    - start_time: UTC in seconds since the epoch, or -1 if undefined (all bits
+*      set, e.g. events of NVOD reference services)
+*    - descriptors_offset, descriptors_length: bytes of the descriptor loop of the
+*      event, relative to the start of the section
+*  NOTES
+*    Filled by extract_events. sections refers to the extracted data, which must
+*    outlive its use.
+*  SOURCE
+*/
+struct event_columns {
+	std::vector<gsl::span<const char>>	sections;
+
+	std::vector<uint_least32_t>			section;
+	std::vector<uint_least8_t>			table_id;
+	std::vector<uint_least16_t>			service_id;
+	std::vector<uint_least16_t>			transport_stream_id;
+	std::vector<uint_least16_t>			original_network_id;
+	std::vector<uint_least16_t>			event_id;
+	std::vector<time_t>					start_time;
+	std::vector<int_least32_t>			duration;
+	std::vector<uint_least8_t>			running_status;
+	std::vector<uint_least8_t>			free_CA_mode;
+	std::vector<uint_least16_t>			descriptors_offset;
+	std::vector<uint_least16_t>			descriptors_length;
+
+	size_t size() const noexcept { return event_id.size(); }
+
+	void reserve(size_t events)
+	{
+		section.reserve(events);
+		table_id.reserve(events);
+		service_id.reserve(events);
+		transport_stream_id.reserve(events);
+		original_network_id.reserve(events);
+		event_id.reserve(events);
+		start_time.reserve(events);
+		duration.reserve(events);
+		running_status.reserve(events);
+		free_CA_mode.reserve(events);
+		descriptors_offset.reserve(events);
+		descriptors_length.reserve(events);
+	}
+
+	void clear() noexcept
+	{
+		sections.clear();
+		section.clear();
+		table_id.clear();
+		service_id.clear();
+		transport_stream_id.clear();
+		original_network_id.clear();
+		event_id.clear();
+		start_time.clear();
+		duration.clear();
+		running_status.clear();
+		free_CA_mode.clear();
+		descriptors_offset.clear();
+		descriptors_length.clear();
+	}
+};
+/*******/
+
+
+namespace {
+	// start_time with all 40 bits set
+	inline bool undefined_time(gsl::span<const char> time) noexcept
+	{
+		return std::all_of(time.cbegin(), time.cend(), [](char c) { return static_cast<uint8_t>(c) == 0xff; });
+	}
+}
+
+/****f* tssi/extract_events
+*  NAME
+*    extract_events -- Appends the events of an event information section (table_id
+*    0x4e to 0x6f) to columns, walking the event loop once. Returns the number of
+*    events appended. Sections of other tables, and events truncated by the end of
+*    the section, are skipped.
+*    e.g.
+*       event_columns columns;
+*       for (const auto& section : heap.psi_heap().table_range(0x4e, 0x6f))
+*           extract_events(section.second.psi_data(), columns);
+*  SYNOPSIS
+*/
+inline size_t extract_events(gsl::span<const char> section, event_columns& columns)
+/*******/
+{
+	using namespace etsi300468::event_information_section;
+
+	if (section.size() < 18)
+		return 0;
+	const auto header = decode_header(section);
+	if (header.table_id < 0x4e || header.table_id > 0x6f)
+		return 0;
+
+	const auto index = static_cast<uint_least32_t>(columns.sections.size());
+	const std::ptrdiff_t end = section.size() - 4; // CRC_32
+	size_t count = 0;
+
+	for (std::ptrdiff_t offset = 14; offset + 12 <= end; ) {
+		const auto entry = loop::decode_entry(section.subspan(offset, end - offset));
+		const auto size = static_cast<std::ptrdiff_t>(entry.descriptors_loop_length) + 12;
+		if (offset + size > end)
+			break; // truncated
+
+		columns.section.push_back(index);
+		columns.table_id.push_back(static_cast<uint_least8_t>(header.table_id));
+		columns.service_id.push_back(static_cast<uint_least16_t>(header.service_id));
+		columns.transport_stream_id.push_back(static_cast<uint_least16_t>(header.transport_stream_id));
+		columns.original_network_id.push_back(static_cast<uint_least16_t>(header.original_network_id));
+		columns.event_id.push_back(static_cast<uint_least16_t>(entry.event_id));
+		columns.start_time.push_back(undefined_time(section.subspan(offset + 2, 5)) ? time_t(-1) : entry.start_time);
+		columns.duration.push_back(static_cast<int_least32_t>(entry.duration.count()));
+		columns.running_status.push_back(static_cast<uint_least8_t>(entry.running_status));
+		columns.free_CA_mode.push_back(entry.free_CA_mode ? 1 : 0);
+		columns.descriptors_offset.push_back(static_cast<uint_least16_t>(offset + 12));
+		columns.descriptors_length.push_back(static_cast<uint_least16_t>(entry.descriptors_loop_length));
+
+		offset += size;
+		++count;
+	}
+
+	if (count > 0)
+		columns.sections.push_back(section);
+	return count;
+}
+
+}
@@ -0,0 +1,121 @@
+/*++
+*    tssi - A library for parsing MPEG-2 and DVB Transport Streams
+*
+*    Copyright (C) 2017 Martin Hoernig (goforcode.com)
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+--*/
+
+#pragma once
+
+#include <string>
+#include <gsl/span>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif // NOMINMAX
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif // WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else // _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif // _WIN32
+
+namespace tssi
+{
+
+/****c* tssi/MappedFile
+*  NAME
+*    MappedFile -- Maps a file read-only into memory. Used by PSIHeap/heap_load.
+*  NOTES
+*    The data is empty if the file could not be mapped.
+*  METHODS
+*    file_data
+*****/
+class MappedFile {
+public:
+	explicit MappedFile(const std::string& path)
+	{
+#ifdef _WIN32
+		file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file == INVALID_HANDLE_VALUE)
+			return;
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(file, &size) || size.QuadPart == 0)
+			return;
+		mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (mapping == nullptr)
+			return;
+		address = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+		if (address != nullptr)
+			length = static_cast<size_t>(size.QuadPart);
+#else // _WIN32
+		const int fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+			return;
+		struct stat status;
+		if (fstat(fd, &status) == 0 && status.st_size > 0) {
+			void* mapped = mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+			if (mapped != MAP_FAILED) {
+				address = static_cast<const char*>(mapped);
+				length = static_cast<size_t>(status.st_size);
+			}
+		}
+		close(fd); // the mapping stays valid
+#endif // _WIN32
+	}
+
+	~MappedFile()
+	{
+#ifdef _WIN32
+		if (address != nullptr)
+			UnmapViewOfFile(address);
+		if (mapping != nullptr)
+			CloseHandle(mapping);
+		if (file != INVALID_HANDLE_VALUE)
+			CloseHandle(file);
+#else // _WIN32
+		if (address != nullptr)
+			munmap(const_cast<char*>(address), length);
+#endif // _WIN32
+	}
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	/****m* MappedFile/file_data
+	*  NAME
+	*    file_data -- Retrieve a span to the mapped file.
+	*  SYNOPSIS
+	*/
+	gsl::span<const char> file_data() const noexcept
+	/*******/
+	{ return gsl::span<const char>(address, static_cast<std::ptrdiff_t>(length)); }
+
+private:
+#ifdef _WIN32
+	HANDLE			file = INVALID_HANDLE_VALUE;
+	HANDLE			mapping = nullptr;
+#endif // _WIN32
+	const char*		address = nullptr;
+	size_t			length = 0;
+};
+
+}
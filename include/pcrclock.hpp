@@ -0,0 +1,282 @@
+/*++
+*    tssi - A library for parsing MPEG-2 and DVB Transport Streams
+*
+*    Copyright (C) 2017 Martin Hoernig (goforcode.com)
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+--*/
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include "processnode.hpp"
+#include "specifications.hpp"
+
+namespace tssi
+{
+
+/****t* tssi/pcr_sample
+*  NAME
+*    pcr_sample -- Program clock reference (PCR) found in the stream:
+*    - packet_index: number of the transport packet fed to the clock (counted
+*      from 0)
+*    - pcr: program_clock_reference_base * 300 + program_clock_reference_extension
+*      (27 MHz)
+*  DATA SCOPE
+*    iso138181::adaptation_field
+*  SOURCE
+*/
+struct pcr_sample {
+	uint_fast64_t packet_index = 0;
+	uint_fast64_t pcr = 0;
+};
+/*******/
+
+/****c* tssi/PCRClock
+*  NAME
+*    PCRClock -- Recovers the program clocks of a transport stream. For every PID
+*    carrying PCRs the last sample and the multiplex bitrate are tracked. With both,
+*    a 27 MHz timestamp can be interpolated for every transport packet.
+*  NOTES
+*    Feed this class with all PIDs of the transport stream to count packets
+*    correctly, e.g.
+*      parser.pid_parser(clock);
+*    Up to max_clocks PCR PIDs are tracked. State is of fixed size and may be read
+*    lock-free by other threads while the stream is processed.
+*  DERIVED FROM
+*    ProcessNode
+*  DATA SCOPE
+*    iso138181::transport_packet
+*    iso138181::adaptation_field
+*  METHODS
+*    pcr_reset
+*    pcr_callback
+*    pcr_last
+*    pcr_bitrate
+*    pcr_time
+*    pcr_packet_index
+*****/
+class PCRClock : public ProcessNode {
+public:
+	static constexpr size_t max_clocks = 8;
+	static constexpr uint_fast64_t pcr_frequency = 27000000;
+	static constexpr uint_fast64_t pcr_wrap = (static_cast<uint_fast64_t>(1) << 33) * 300;
+
+	/****m* PCRClock/pcr_reset
+	*  NAME
+	*    pcr_reset -- Forgets all clocks and restarts packet counting. Must not be
+	*    called while the stream is processed.
+	*  SYNOPSIS
+	*/
+	void pcr_reset() noexcept
+	/*******/
+	{
+		packet_count.store(0, std::memory_order_relaxed);
+		for (auto& clock : clocks) {
+			clock.sequence.store(0, std::memory_order_relaxed);
+			clock.pid.store(no_pid, std::memory_order_relaxed);
+			clock.bitrate.store(0, std::memory_order_relaxed);
+		}
+	}
+
+	/****m* PCRClock/pcr_callback
+	*  NAME
+	*    pcr_callback -- Establish a callback, called for every PCR found in the stream.
+	*  SYNOPSIS
+	*/
+	void pcr_callback(std::function< void(uint_fast16_t pid, const pcr_sample& sample) >&& cb)
+	/*******/
+	{ transfer_callback = cb; }
+
+	/****m* PCRClock/pcr_last
+	*  NAME
+	*    pcr_last -- Returns the last PCR found on pid. The sample is zero if no PCR
+	*    was found yet. Thread-safe.
+	*  SYNOPSIS
+	*/
+	pcr_sample pcr_last(uint_fast16_t pid) const noexcept
+	/*******/
+	{
+		pcr_sample sample;
+		uint_fast64_t bitrate;
+		read(pid, sample, bitrate);
+		return sample;
+	}
+
+	/****m* PCRClock/pcr_bitrate
+	*  NAME
+	*    pcr_bitrate -- Returns the estimated multiplex bitrate (bit/s) measured with
+	*    the clock on pid or 0 if not known yet. Thread-safe.
+	*  SYNOPSIS
+	*/
+	uint_fast64_t pcr_bitrate(uint_fast16_t pid) const noexcept
+	/*******/
+	{
+		pcr_sample sample;
+		uint_fast64_t bitrate;
+		read(pid, sample, bitrate);
+		return bitrate;
+	}
+
+	/****m* PCRClock/pcr_time
+	*  NAME
+	*    pcr_time -- Interpolates the 27 MHz timestamp of the transport packet with
+	*    packet_index by the clock on pid. Returns 0 if the bitrate is not known yet.
+	*    Thread-safe.
+	*  SYNOPSIS
+	*/
+	uint_fast64_t pcr_time(uint_fast16_t pid, uint_fast64_t packet_index) const noexcept
+	/*******/
+	{
+		pcr_sample sample;
+		uint_fast64_t bitrate;
+		read(pid, sample, bitrate);
+		if (bitrate == 0)
+			return 0;
+
+		const uint_fast64_t distance = (packet_index >= sample.packet_index ?
+			packet_index - sample.packet_index : sample.packet_index - packet_index) * 188 * 8;
+		const uint_fast64_t ticks = static_cast<uint_fast64_t>(
+			static_cast<long double>(distance) * pcr_frequency / bitrate) % pcr_wrap;
+
+		return packet_index >= sample.packet_index ?
+			(sample.pcr + ticks) % pcr_wrap : (sample.pcr + pcr_wrap - ticks) % pcr_wrap;
+	}
+
+	/****m* PCRClock/pcr_packet_index
+	*  NAME
+	*    pcr_packet_index -- Returns the number of transport packets processed so far,
+	*    i.e. the packet_index of the next packet. Thread-safe.
+	*  SYNOPSIS
+	*/
+	uint_fast64_t pcr_packet_index() const noexcept
+	/*******/
+	{ return packet_count.load(std::memory_order_acquire); }
+
+private:
+	static constexpr uint_fast16_t no_pid = 0x2000;
+
+	// seqlock protected state of a single clock
+	struct clock_state {
+		std::atomic<uint_fast32_t> sequence{ 0 };
+		std::atomic<uint_fast16_t> pid{ no_pid };
+		std::atomic<uint_fast64_t> packet_index{ 0 };
+		std::atomic<uint_fast64_t> pcr{ 0 };
+		std::atomic<uint_fast64_t> bitrate{ 0 };
+	};
+
+	void process(gsl::span<const char> data)
+	{
+		Expects(data.size() == 188);
+
+		using namespace iso138181;
+		using namespace transport_packet;
+
+		const auto index = packet_count.load(std::memory_order_relaxed);
+		packet_count.store(index + 1, std::memory_order_release);
+
+		if (transport_error_indicator(data))
+			return; // packet corrupt
+
+		if ((adaptation_field_control(data) & 0x02) == 0)
+			return; // no adaptation field
+
+		const auto field = data.subspan(4);
+		if (adaptation_field::adaptation_field_length(field) < 7 ||
+			!adaptation_field::PCR_flag(field))
+			return;
+
+		const auto pid = PID(data);
+		auto clock = find(pid);
+		if (clock == nullptr)
+			return; // all clocks in use
+
+		pcr_sample sample;
+		sample.packet_index = index;
+		sample.pcr = adaptation_field::program_clock_reference_base(field) * 300 +
+			adaptation_field::program_clock_reference_extension(field);
+
+		// bitrate estimation
+		auto bitrate = clock->bitrate.load(std::memory_order_relaxed);
+		const auto last_index = clock->packet_index.load(std::memory_order_relaxed);
+		const auto last_pcr = clock->pcr.load(std::memory_order_relaxed);
+		if (clock->sequence.load(std::memory_order_relaxed) > 0 &&
+			!adaptation_field::discontinuity_indicator(field) &&
+			index > last_index) {
+			const auto ticks = (sample.pcr + pcr_wrap - last_pcr) % pcr_wrap;
+			if (ticks > 0 && ticks < pcr_frequency) { // ignore gaps of a second and more
+				const uint_fast64_t measured = static_cast<uint_fast64_t>(
+					static_cast<long double>(index - last_index) * 188 * 8 * pcr_frequency / ticks);
+				bitrate = bitrate == 0 ? measured : bitrate - bitrate / 8 + measured / 8;
+			}
+		}
+
+		// publish
+		const auto sequence = clock->sequence.load(std::memory_order_relaxed);
+		clock->sequence.store(sequence + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		clock->packet_index.store(sample.packet_index, std::memory_order_relaxed);
+		clock->pcr.store(sample.pcr, std::memory_order_relaxed);
+		clock->bitrate.store(bitrate, std::memory_order_relaxed);
+		clock->sequence.store(sequence + 2, std::memory_order_release);
+
+		if (transfer_callback)
+			transfer_callback(pid, sample);
+	}
+
+	clock_state* find(uint_fast16_t pid) noexcept
+	{
+		for (auto& clock : clocks) {
+			const auto clock_pid = clock.pid.load(std::memory_order_relaxed);
+			if (clock_pid == pid)
+				return &clock;
+			if (clock_pid == no_pid) {
+				clock.pid.store(pid, std::memory_order_release);
+				return &clock;
+			}
+		}
+		return nullptr;
+	}
+
+	void read(uint_fast16_t pid, pcr_sample& sample, uint_fast64_t& bitrate) const noexcept
+	{
+		sample = pcr_sample();
+		bitrate = 0;
+		for (const auto& clock : clocks) {
+			if (clock.pid.load(std::memory_order_acquire) != pid)
+				continue;
+
+			uint_fast32_t before, after;
+			do {
+				before = clock.sequence.load(std::memory_order_acquire);
+				sample.packet_index = clock.packet_index.load(std::memory_order_relaxed);
+				sample.pcr = clock.pcr.load(std::memory_order_relaxed);
+				bitrate = clock.bitrate.load(std::memory_order_relaxed);
+				std::atomic_thread_fence(std::memory_order_acquire);
+				after = clock.sequence.load(std::memory_order_relaxed);
+			} while ((before & 1) || before != after);
+			return;
+		}
+	}
+
+	std::array<clock_state, max_clocks>		clocks;
+	std::atomic<uint_fast64_t>				packet_count{ 0 };
+
+	std::function< void(uint_fast16_t, const pcr_sample&) >	transfer_callback;
+
+};
+
+}
@@ -28,6 +28,31 @@
 namespace tssi
 {
 
+/****t* tssi/pes_fragment_t
+*  NAME
+*    pes_fragment_t -- Position of a fragment within a PES packet. The first fragment
+*    carries pes_fragment_start, the last one pes_fragment_end. Fragments in between
+*    carry neither. A packet delivered in one piece carries both flags.
+*  SOURCE
+*/
+enum pes_fragment_t : uint_fast8_t {
+	pes_fragment_continue = 0x0,
+	pes_fragment_start = 0x1,
+	pes_fragment_end = 0x2
+};
+/*******/
+
+/****t* tssi/fragment_callback_t
+*  NAME
+*    fragment_callback_t -- Function to call when a fragment of a data unit is available.
+*    flags is a combination of pes_fragment_t values.
+*  DATA SCOPE
+*    iso138181::PES_packet
+*  SYNOPSIS
+*/
+typedef std::function< void(gsl::span<const char> data, uint_fast8_t flags) > fragment_callback_t;
+/*******/
+
 /****c* tssi/PESAssembler
 *  NAME
 *    PESAssembler -- Compiles transport packets to iso138181::PES_packet and makes 
@@ -38,7 +63,12 @@ namespace tssi
 *    iso138181::transport_packet
 *  METHODS
 *    pes_reset
+*    pes_drop
 *    pes_callback
+*    pes_chunk_callback
+*    pes_chunk_size
+*    pes_limit
+*    pes_payload_callback
 *  
 *****/
 template <class _Alloc = std::allocator<char> >
@@ -52,7 +82,17 @@ public:
 	*/
 	void pes_reset() noexcept
 	/*******/
-	{ sink_callbacks.clear(); }
+	{ sink_callbacks.clear(); chunk_callbacks.clear(); payload_callbacks.clear(); }
+
+	/****m* PESAssembler/pes_drop
+	*  NAME
+	*    pes_drop -- Discards the PES packet in assembly on a certain PID. Assembly
+	*    resumes with the next payload unit start of the PID.
+	*  SYNOPSIS
+	*/
+	void pes_drop(uint_fast16_t pid)
+	/*******/
+	{ open_packets.erase(pid); }
 
 	/****m* PESAssembler/pes_callback
 	*  NAME
@@ -64,9 +104,67 @@ public:
 	/*******/
 	{ Expects(pid <= 8192); sink_callbacks.insert({ pid, cb }); }
 
+	/****m* PESAssembler/pes_chunk_callback
+	*  NAME
+	*    pes_chunk_callback -- Establish a callback for PES packets on a certain PID that 
+	*    are delivered in fragments of pes_chunk_size bytes (see pes_fragment_t). Memory
+	*    held for the PID is bounded by the chunk size, and data is available before the
+	*    packet is complete. Once a chunk callback exists for a PID, the PID is no longer 
+	*    served by pes_callback.
+	*  NOTES
+	*    The end of a packet is only known with the next payload unit start. Thus, the 
+	*    last fragment might be empty.
+	*  SYNOPSIS
+	*/
+	void pes_chunk_callback(uint_fast16_t pid, fragment_callback_t&& cb)
+	/*******/
+	{ Expects(pid <= 8192); chunk_callbacks.insert({ pid, cb }); }
+
+	/****m* PESAssembler/pes_chunk_size
+	*  NAME
+	*    pes_chunk_size -- Sets the size of fragments delivered to pes_chunk_callback,
+	*    at least 188 bytes.
+	*  SYNOPSIS
+	*/
+	void pes_chunk_size(size_t bytes)
+	/*******/
+	{ Expects(bytes >= 188); chunk_size = bytes; }
+
+	/****m* PESAssembler/pes_limit
+	*  NAME
+	*    pes_limit -- Limits the bytes buffered for a single PES packet per PID. Packets 
+	*    exceeding the limit (e.g. unbounded video packets whose successor's payload 
+	*    unit start got lost) are discarded up to the next payload unit start. A value
+	*    of 0 disables the limit (default).
+	*  SYNOPSIS
+	*/
+	void pes_limit(size_t bytes) noexcept
+	/*******/
+	{ max_packet_bytes = bytes; }
+
+	/****m* PESAssembler/pes_payload_callback
+	*  NAME
+	*    pes_payload_callback -- Establish a pass-through callback on a certain PID. The 
+	*    payload of every transport packet (following the adaptation field) is forwarded
+	*    in order without being copied or assembled. The flag pes_fragment_start marks 
+	*    payloads that start a new PES packet. If a PID has pass-through callbacks only,
+	*    no PES packets are assembled for it.
+	*  NOTES
+	*    The span is only valid during the call.
+	*  SYNOPSIS
+	*/
+	void pes_payload_callback(uint_fast16_t pid, fragment_callback_t&& cb)
+	/*******/
+	{ Expects(pid <= 8192); payload_callbacks.insert({ pid, cb }); }
+
 private:
 	const size_t packet_standard_length = 16384;
 
+	struct open_packet {
+		std::vector<char, _Alloc> data;
+		bool fragmented = false; // start fragment already delivered
+	};
+
 	void process(gsl::span<const char> data)
 	{
 		Expects(data.size() == 188);
@@ -87,30 +185,89 @@ private:
 
 		if (adaptation_field_control(data) == 0x03) {
 			// adaptation field
-			payload += adaptation_field::adaptation_field_length(data.subspan(4)) + 1;
+			const auto adaptation_length = adaptation_field::adaptation_field_length(data.subspan(4)) + 1;
+			if (adaptation_length >= data.cend() - payload)
+				return; // no payload or corrupt adaptation field
+			payload += adaptation_length;
+		}
+
+		auto pass_through = payload_callbacks.equal_range(pid);
+		if (pass_through.first != pass_through.second) {
+			const auto flags = payload_unit_start_indicator(data) ? 
+				pes_fragment_start : pes_fragment_continue;
+			const auto payload_data = data.subspan(payload - data.cbegin());
+			for (auto it = pass_through.first; it != pass_through.second; ++it) {
+				it->second(payload_data, flags);
+			}
+
+			if (sink_callbacks.count(pid) == 0 && chunk_callbacks.count(pid) == 0)
+				return; // nothing to assemble
 		}
 
+		const bool chunked = chunk_callbacks.count(pid) > 0;
+
 		if (payload_unit_start_indicator(data)) {
 			auto packet = open_packets.find(pid);
-			if (packet != open_packets.end() && packet->second.size() > 0) {
+			if (packet != open_packets.end()) {
 				// send packet
-				filter(pid, packet->second);
+				if (packet->second.fragmented)
+					filter_fragment(pid, packet->second, pes_fragment_end);
+				else if (packet->second.data.size() > 0) {
+					if (chunked)
+						filter_fragment(pid, packet->second, pes_fragment_end);
+					else
+						filter(pid, packet->second.data);
+				}
 
-				packet->second.clear();
+				packet->second.data.clear();
+				packet->second.fragmented = false;
 			}
 
 			using namespace PES_packet;
-			auto packet_length = PES_packet_length(data.subspan(payload - data.cbegin()));
+			size_t packet_length = PES_packet_length(data.subspan(payload - data.cbegin()));
 			// GSL span initialization by iterators is on the way...
-			if (packet_length != 0)
-				open_packets[pid].reserve(packet_length); // reserve if not already reserved...
-			else
-				open_packets[pid].reserve(packet_standard_length);
+			if (packet_length == 0)
+				packet_length = packet_standard_length;
+			if (chunked)
+				packet_length = chunk_size;
+			else if (max_packet_bytes > 0)
+				packet_length = std::min(packet_length, max_packet_bytes);
+			open_packets[pid].data.reserve(packet_length); // reserve if not already reserved...
 		}
 
 		auto packet = open_packets.find(pid);
-		if (packet != open_packets.end())
-			copy(payload, data.cend(), back_inserter(packet->second));
+		if (packet == open_packets.end())
+			return;
+
+		auto& buffer = packet->second;
+		if (chunked) {
+			for (;;) {
+				// the buffer may exceed the chunk size if pes_chunk_size was lowered or
+				// the chunk callback was added while a packet was open
+				if (buffer.data.size() >= chunk_size) {
+					if (!filter_fragment(pid, buffer, pes_fragment_continue)) {
+						open_packets.erase(packet); // not a PES packet, wait for next start
+						return;
+					}
+					buffer.data.clear();
+				}
+				if (payload == data.cend())
+					break;
+
+				const auto n = std::min(data.cend() - payload, 
+					static_cast<ptrdiff_t>(chunk_size - buffer.data.size()));
+				copy(payload, payload + n, back_inserter(buffer.data));
+				payload += n;
+			}
+		}
+		else {
+			if (max_packet_bytes > 0 &&
+				buffer.data.size() + (data.cend() - payload) > max_packet_bytes) {
+				open_packets.erase(packet); // packet too long, wait for next start
+				return;
+			}
+			copy(payload, data.cend(), back_inserter(buffer.data));
+		}
 
 	}
 
@@ -133,11 +290,40 @@ private:
 
 	}
 
-	std::map<uint_fast16_t, std::vector<char, _Alloc>>
+	bool filter_fragment(uint_fast16_t pid, open_packet& packet, uint_fast8_t flags) const
+	{
+		using namespace iso138181;
+		using namespace PES_packet;
+
+		if (!packet.fragmented) {
+			// validate
+			if (packet.data.size() < 6 || 
+				packet_start_code_prefix(packet.data) != 0x000001)
+				return false;
+			flags |= pes_fragment_start;
+			packet.fragmented = true;
+		}
+
+		auto range = chunk_callbacks.equal_range(pid);
+		for (auto it = range.first; it != range.second; ++it) {
+			it->second(packet.data, flags);
+		}
+
+		return true;
+	}
+
+	std::map<uint_fast16_t, open_packet>
 		open_packets; // PID -> data
 
 	std::unordered_multimap<uint_fast16_t, callback_t>
 		sink_callbacks;
+	std::unordered_multimap<uint_fast16_t, fragment_callback_t>
+		chunk_callbacks;
+	std::unordered_multimap<uint_fast16_t, fragment_callback_t>
+		payload_callbacks;
+
+	size_t chunk_size = packet_standard_length;
+	size_t max_packet_bytes = 0;
 
 };
 
@@ -0,0 +1,227 @@
+/*++
+*    tssi - A library for parsing MPEG-2 and DVB Transport Streams
+*
+*    Copyright (C) 2017 Martin Hoernig (goforcode.com)
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+--*/
+
+#pragma once
+
+#include <map>
+#include <unordered_map>
+#include "processnode.hpp"
+#include "psiheap.hpp"
+#include "pesassembler.hpp"
+
+namespace tssi
+{
+
+/****c* tssi/ProgramFollower
+*  NAME
+*    ProgramFollower -- Follows a single program of a transport stream. The program
+*    association and program map sections are evaluated internally and every
+*    elementary_PID of the program is routed to the callbacks registered for its
+*    stream_type. Changes of the program map are applied in one step, in between
+*    two transport packets. PES packets in assembly on a PID leaving the program
+*    are discarded, and the routing is cleared when the program is no longer listed
+*    in the program association table.
+*  NOTES
+*    Feed this class with all PIDs of the transport stream, e.g.
+*      parser.pid_parser(follower);
+*    All callbacks are called from the thread feeding this ProcessNode.
+*  DERIVED FROM
+*    ProcessNode
+*  DATA SCOPE
+*    iso138181::transport_packet
+*  METHODS
+*    program_follow
+*    program_reset
+*    program_callback
+*    program_streams
+*    program_pcr_pid
+*****/
+template <class _Alloc = std::allocator<char> >
+class ProgramFollower : public ProcessNode {
+public:
+	ProgramFollower()
+	{
+		heap.psi_callback([this](const section_identifier& si) { section_update(si); });
+	}
+
+	ProgramFollower(const ProgramFollower<_Alloc>&) = delete;
+	ProgramFollower<_Alloc>& operator=(const ProgramFollower<_Alloc>&) = delete;
+
+	/****m* ProgramFollower/program_follow
+	*  NAME
+	*    program_follow -- Subscribe to a program_number. Routing information of a
+	*    previously followed program is discarded. The program_number 0 (default) does
+	*    not follow any program.
+	*  SYNOPSIS
+	*/
+	void program_follow(uint_fast16_t program_number)
+	/*******/
+	{
+		followed_program = program_number;
+		pmt_pid = no_pid;
+		rewire(std::map<uint_fast16_t, uint_fast8_t>(), no_pid);
+		heap.heap_reset(); // re-read the PAT
+	}
+
+	/****m* ProgramFollower/program_reset
+	*  NAME
+	*    program_reset -- Clears stored callback function mapping.
+	*  SYNOPSIS
+	*/
+	void program_reset() noexcept
+	/*******/
+	{ stream_callbacks.clear(); }
+
+	/****m* ProgramFollower/program_callback
+	*  NAME
+	*    program_callback -- Establish a callback for Packetized Elementary Stream (PES)
+	*    packets of all elementary streams with the given stream_type in the followed
+	*    program. Multiple callbacks per stream_type are possible.
+	*  DATA SCOPE
+	*    iso138181::PES_packet
+	*  SYNOPSIS
+	*/
+	void program_callback(uint_fast8_t stream_type, callback_t&& cb)
+	/*******/
+	{ stream_callbacks.insert({ stream_type, cb }); }
+
+	/****m* ProgramFollower/program_streams
+	*  NAME
+	*    program_streams -- Returns the current routing table (elementary_PID ->
+	*    stream_type) of the followed program.
+	*  SYNOPSIS
+	*/
+	const std::map<uint_fast16_t, uint_fast8_t>& program_streams() const noexcept
+	/*******/
+	{ return routes; }
+
+	/****m* ProgramFollower/program_pcr_pid
+	*  NAME
+	*    program_pcr_pid -- Returns the PCR_PID of the followed program or 0x2000 if the
+	*    program map has not been received yet.
+	*  SYNOPSIS
+	*/
+	uint_fast16_t program_pcr_pid() const noexcept
+	/*******/
+	{ return pcr_pid; }
+
+private:
+	static constexpr uint_fast16_t no_pid = 0x2000;
+
+	void process(gsl::span<const char> data)
+	{
+		Expects(data.size() == 188);
+
+		const auto pid = iso138181::transport_packet::PID(data);
+
+		if (pid == 0x00 || pid == pmt_pid)
+			heap(data);
+		else if (routes.find(pid) != routes.end())
+			assembler(data);
+	}
+
+	void section_update(const section_identifier& si)
+	{
+		if (std::get<0>(si) == 0x00) {
+			// PAT -> PMT PID, the program may be listed in any section of the PAT
+			using namespace iso138181::program_association_section;
+			auto pid = no_pid;
+			for (const auto& section : heap.psi_heap().table_range(0x00, 0x00)) {
+				auto data = section.second.psi_data();
+				for (size_t i = 0; i < N(data); ++i) {
+					if (followed_program != 0 && program_number(data, i) == followed_program)
+						pid = program_map_PID(data, i);
+				}
+			}
+			if (pid == pmt_pid)
+				return;
+
+			pmt_pid = pid;
+			if (pmt_pid == no_pid) {
+				// the program is gone
+				rewire(std::map<uint_fast16_t, uint_fast8_t>(), no_pid);
+				return;
+			}
+
+			// a program map stored before is not reported again
+			for (const auto& section : heap.psi_heap().table_range(table_identifier(0x02, followed_program)))
+				program_map(section.second.psi_data());
+		}
+		else if (std::get<0>(si) == 0x02 && std::get<1>(si) == followed_program && pmt_pid != no_pid) {
+			program_map(heap.psi_heap().at(si).psi_data());
+		}
+	}
+
+	// PMT -> routing
+	void program_map(gsl::span<const char> data)
+	{
+		using namespace iso138181::TS_program_map_section;
+
+		std::map<uint_fast16_t, uint_fast8_t> streams;
+		for (auto loop : program_info_loop(data)) {
+			streams[loop::elementary_PID(loop)] = loop::stream_type(loop);
+		}
+
+		rewire(std::move(streams), PCR_PID(data));
+	}
+
+	void rewire(std::map<uint_fast16_t, uint_fast8_t>&& streams, uint_fast16_t pcr)
+	{
+		// packets in assembly on a PID that leaves or changes its stream_type are dropped
+		for (const auto& route : routes) {
+			auto stream = streams.find(route.first);
+			if (stream == streams.end() || stream->second != route.second)
+				assembler.pes_drop(route.first);
+		}
+
+		pcr_pid = pcr;
+		routes.swap(streams);
+		assembler.pes_reset();
+		for (const auto& route : routes) {
+			const auto pid = route.first;
+			assembler.pes_callback(pid, [this, pid](gsl::span<const char> pes) { deliver(pid, pes); });
+		}
+	}
+
+	void deliver(uint_fast16_t pid, gsl::span<const char> data) const
+	{
+		auto route = routes.find(pid);
+		if (route == routes.end())
+			return;
+
+		auto range = stream_callbacks.equal_range(route->second);
+		for (auto it = range.first; it != range.second; ++it) {
+			it->second(data);
+		}
+	}
+
+	PSIHeap<_Alloc>										heap; // PAT and PMT
+	PESAssembler<_Alloc>								assembler;
+
+	uint_fast16_t										followed_program = 0;
+	uint_fast16_t										pmt_pid = no_pid;
+	uint_fast16_t										pcr_pid = no_pid;
+	std::map<uint_fast16_t, uint_fast8_t>				routes; // elementary_PID -> stream_type
+
+	std::unordered_multimap<uint_fast8_t, callback_t>	stream_callbacks;
+
+};
+
+}
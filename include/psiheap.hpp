@@ -21,159 +21,274 @@
 #pragma once
 
 #include <vector>
+#include <deque>
+#include <array>
+#include <bitset>
+#include <memory>
 #include <map>
+#include <algorithm>
+#include <iterator>
+#include <stdexcept>
+#include <unordered_map>
+#include <atomic>
 #include <mutex>
 #include <shared_mutex>
 #include <thread>
+#include <string>
+#include <fstream>
+#include <cstdio>
+#include <chrono>
+#include <ctime>
 #include "processnode.hpp"
 #include "specifications.hpp"
+#include "crc32.hpp"
+#include "mappedfile.hpp"
+#include "descriptorindex.hpp"
+#include "psisection.hpp"
+#include "psistore.hpp"
+#include "psisnapshot.hpp"
+#include "sectiondelta.hpp"
 
 namespace tssi
 {
 
-template <class _Alloc>
-class PSIHeap;
-
-/****t* tssi/section_identifier
+/****c* tssi/section_buffer
 *  NAME
-*    section_identifier -- Identifier for PSI sections. They define: 
-*    - table_id
-*    - table_id_extension
-*    - section_number
+*    section_buffer -- Byte buffer of a PSI section. Sections of up to
+*    inline_capacity bytes, i.e. all sections fitting into a single transport
+*    packet, are stored within the object. Only larger sections allocate.
 *  NOTES
-*    Sections with section_syntax_indicator == 0x0 have both table_id_extension and 
-*    section_number set to 0.
-*  DATA SCOPE
-*    iso138181::private_section
-*    iso138181::private_section_syntax
-*  SOURCE
-*/
-using section_identifier =
-std::tuple<uint_fast8_t, uint_fast16_t, uint_fast8_t>; 
-/*******/
-
-
-/****c* tssi/PSISection
-*  NAME
-*    PSISection -- Storage unit for a PSI section. Used by PSIHeap.
-*  DERIVED FROM
-*    ProcessNode
-*  DATA SCOPE
-*    iso138181::private_section
-*    iso138181::private_section_syntax
+*    Used by PSIHeap for sections being assembled.
 *  METHODS
-*    psi_data
-*    sizechars
-*    section_key
-*    crc32
+*    data
+*    size
+*    empty
+*    reserve
+*    append
+*    assign
+*    clear
 *****/
 template <class _Alloc = std::allocator< char > >
-class PSISection : public ProcessNode {
+class section_buffer {
 public:
-	/****m* PSISection/psi_data
+	static constexpr size_t inline_capacity = 184;
+
+	section_buffer() = default;
+
+	section_buffer(const section_buffer<_Alloc>& other)
+	{ assign(other.data(), other.data() + other.size()); }
+
+	section_buffer<_Alloc>& operator=(const section_buffer<_Alloc>& other)
+	{
+		if (this != &other)
+			assign(other.data(), other.data() + other.size());
+		return *this;
+	}
+
+	section_buffer(section_buffer<_Alloc>&& other) noexcept
+		: external(std::move(other.external)), length(other.length), spilled(other.spilled)
+	{
+		if (!spilled)
+			std::copy(other.local.cbegin(), other.local.cbegin() + length, local.begin());
+		other.clear();
+	}
+
+	section_buffer<_Alloc>& operator=(section_buffer<_Alloc>&& other) noexcept
+	{
+		if (this != &other) {
+			external = std::move(other.external);
+			length = other.length;
+			spilled = other.spilled;
+			if (!spilled)
+				std::copy(other.local.cbegin(), other.local.cbegin() + length, local.begin());
+			other.clear();
+		}
+		return *this;
+	}
+
+	/****m* section_buffer/data
+	*  NAME
+	*    data -- Returns a pointer to the first byte.
+	*  SYNOPSIS
+	*/
+	const char* data() const noexcept
+	/*******/
+	{ return spilled ? external.data() : local.data(); }
+
+	/****m* section_buffer/size
 	*  NAME
-	*    psi_data -- Retrieve a span to the data buffer of the section.
-	*  DATA SCOPE
-	*    iso138181::private_section
-	*    iso138181::private_section_syntax
+	*    size -- Returns the number of bytes stored.
 	*  SYNOPSIS
 	*/
-	gsl::span<const char> psi_data() const noexcept
+	size_t size() const noexcept
 	/*******/
-	{ return section_data; }
+	{ return length; }
 
-	/****m* PSISection/sizechars
+	/****m* section_buffer/empty
 	*  NAME
-	*    sizechars -- Returns the size of the section (in bytes). This is not
-	*    section_length!
+	*    empty -- Returns true if no bytes are stored.
 	*  SYNOPSIS
 	*/
-	ptrdiff_t sizechars() const noexcept
+	bool empty() const noexcept
 	/*******/
-	{ return section_length; }
+	{ return length == 0; }
 
-	/****m* PSISection/section_key
+	/****m* section_buffer/reserve
 	*  NAME
-	*    section_key -- Returns the identifier of the section.
+	*    reserve -- Prepares the buffer for size bytes. Allocates if size exceeds
+	*    inline_capacity.
 	*  SYNOPSIS
 	*/
-	section_identifier section_key() const noexcept
+	void reserve(size_t size)
 	/*******/
-	{ return heap_key; }
+	{
+		if (size > inline_capacity)
+			spill(size);
+	}
 
-	/****m* PSISection/crc32
+	/****m* section_buffer/append
 	*  NAME
-	*    crc32 -- Check the section for validity. NB: Not all sections make use of the 
-	*    CRC32 mechanism.
-	*  TODO
-	*    Calculate checksum faster by utilizing more memory (slice-by-4, -8, or -16).
+	*    append -- Appends the bytes first to last.
 	*  SYNOPSIS
 	*/
-	bool crc32() const
+	template <class It>
+	void append(It first, It last)
 	/*******/
 	{
-		Expects(section_data.size() > 12);
-		uint_fast32_t crc = ~(0u);
-		for (auto iter : section_data) {
-			crc = (crc >> 8) ^ crc32_table[(crc & 0xff) ^ static_cast<unsigned char>(iter)];
+		const auto count = static_cast<size_t>(std::distance(first, last));
+		if (!spilled && length + count <= inline_capacity)
+			std::copy(first, last, local.begin() + length);
+		else {
+			spill(length + count);
+			external.insert(external.end(), first, last);
 		}
-		return ~crc;
+		length += count;
+	}
+
+	/****m* section_buffer/assign
+	*  NAME
+	*    assign -- Replaces the content by the bytes first to last.
+	*  SYNOPSIS
+	*/
+	template <class It>
+	void assign(It first, It last)
+	/*******/
+	{
+		clear();
+		append(first, last);
 	}
 
+	/****m* section_buffer/clear
+	*  NAME
+	*    clear -- Removes all bytes. Allocated memory is kept for reuse.
+	*  SYNOPSIS
+	*/
+	void clear() noexcept
+	/*******/
+	{
+		external.clear();
+		length = 0;
+		spilled = false;
+	}
+
+	operator gsl::span<const char>() const noexcept
+	{ return gsl::span<const char>(data(), static_cast<std::ptrdiff_t>(length)); }
+
 private:
-	friend class PSIHeap<_Alloc>;
-
-	void process(gsl::span<const char> data) { data; Expects(section_data.size() > 8); }
-	std::vector<char, _Alloc> section_data;
-	ptrdiff_t				section_length = 0; // total section length, != iso spec value
-	section_identifier		heap_key;
-
-	static constexpr uint_least32_t crc32_table[256] = {
-		
-			0x00000000,0x77073096,0xEE0E612C,0x990951BA,0x076DC419,0x706AF48F,0xE963A535,0x9E6495A3,
-			0x0EDB8832,0x79DCB8A4,0xE0D5E91E,0x97D2D988,0x09B64C2B,0x7EB17CBD,0xE7B82D07,0x90BF1D91,
-			0x1DB71064,0x6AB020F2,0xF3B97148,0x84BE41DE,0x1ADAD47D,0x6DDDE4EB,0xF4D4B551,0x83D385C7,
-			0x136C9856,0x646BA8C0,0xFD62F97A,0x8A65C9EC,0x14015C4F,0x63066CD9,0xFA0F3D63,0x8D080DF5,
-			0x3B6E20C8,0x4C69105E,0xD56041E4,0xA2677172,0x3C03E4D1,0x4B04D447,0xD20D85FD,0xA50AB56B,
-			0x35B5A8FA,0x42B2986C,0xDBBBC9D6,0xACBCF940,0x32D86CE3,0x45DF5C75,0xDCD60DCF,0xABD13D59,
-			0x26D930AC,0x51DE003A,0xC8D75180,0xBFD06116,0x21B4F4B5,0x56B3C423,0xCFBA9599,0xB8BDA50F,
-			0x2802B89E,0x5F058808,0xC60CD9B2,0xB10BE924,0x2F6F7C87,0x58684C11,0xC1611DAB,0xB6662D3D,
-			0x76DC4190,0x01DB7106,0x98D220BC,0xEFD5102A,0x71B18589,0x06B6B51F,0x9FBFE4A5,0xE8B8D433,
-			0x7807C9A2,0x0F00F934,0x9609A88E,0xE10E9818,0x7F6A0DBB,0x086D3D2D,0x91646C97,0xE6635C01,
-			0x6B6B51F4,0x1C6C6162,0x856530D8,0xF262004E,0x6C0695ED,0x1B01A57B,0x8208F4C1,0xF50FC457,
-			0x65B0D9C6,0x12B7E950,0x8BBEB8EA,0xFCB9887C,0x62DD1DDF,0x15DA2D49,0x8CD37CF3,0xFBD44C65,
-			0x4DB26158,0x3AB551CE,0xA3BC0074,0xD4BB30E2,0x4ADFA541,0x3DD895D7,0xA4D1C46D,0xD3D6F4FB,
-			0x4369E96A,0x346ED9FC,0xAD678846,0xDA60B8D0,0x44042D73,0x33031DE5,0xAA0A4C5F,0xDD0D7CC9,
-			0x5005713C,0x270241AA,0xBE0B1010,0xC90C2086,0x5768B525,0x206F85B3,0xB966D409,0xCE61E49F,
-			0x5EDEF90E,0x29D9C998,0xB0D09822,0xC7D7A8B4,0x59B33D17,0x2EB40D81,0xB7BD5C3B,0xC0BA6CAD,
-			0xEDB88320,0x9ABFB3B6,0x03B6E20C,0x74B1D29A,0xEAD54739,0x9DD277AF,0x04DB2615,0x73DC1683,
-			0xE3630B12,0x94643B84,0x0D6D6A3E,0x7A6A5AA8,0xE40ECF0B,0x9309FF9D,0x0A00AE27,0x7D079EB1,
-			0xF00F9344,0x8708A3D2,0x1E01F268,0x6906C2FE,0xF762575D,0x806567CB,0x196C3671,0x6E6B06E7,
-			0xFED41B76,0x89D32BE0,0x10DA7A5A,0x67DD4ACC,0xF9B9DF6F,0x8EBEEFF9,0x17B7BE43,0x60B08ED5,
-			0xD6D6A3E8,0xA1D1937E,0x38D8C2C4,0x4FDFF252,0xD1BB67F1,0xA6BC5767,0x3FB506DD,0x48B2364B,
-			0xD80D2BDA,0xAF0A1B4C,0x36034AF6,0x41047A60,0xDF60EFC3,0xA867DF55,0x316E8EEF,0x4669BE79,
-			0xCB61B38C,0xBC66831A,0x256FD2A0,0x5268E236,0xCC0C7795,0xBB0B4703,0x220216B9,0x5505262F,
-			0xC5BA3BBE,0xB2BD0B28,0x2BB45A92,0x5CB36A04,0xC2D7FFA7,0xB5D0CF31,0x2CD99E8B,0x5BDEAE1D,
-			0x9B64C2B0,0xEC63F226,0x756AA39C,0x026D930A,0x9C0906A9,0xEB0E363F,0x72076785,0x05005713,
-			0x95BF4A82,0xE2B87A14,0x7BB12BAE,0x0CB61B38,0x92D28E9B,0xE5D5BE0D,0x7CDCEFB7,0x0BDBDF21,
-			0x86D3D2D4,0xF1D4E242,0x68DDB3F8,0x1FDA836E,0x81BE16CD,0xF6B9265B,0x6FB077E1,0x18B74777,
-			0x88085AE6,0xFF0F6A70,0x66063BCA,0x11010B5C,0x8F659EFF,0xF862AE69,0x616BFFD3,0x166CCF45,
-			0xA00AE278,0xD70DD2EE,0x4E048354,0x3903B3C2,0xA7672661,0xD06016F7,0x4969474D,0x3E6E77DB,
-			0xAED16A4A,0xD9D65ADC,0x40DF0B66,0x37D83BF0,0xA9BCAE53,0xDEBB9EC5,0x47B2CF7F,0x30B5FFE9,
-			0xBDBDF21C,0xCABAC28A,0x53B39330,0x24B4A3A6,0xBAD03605,0xCDD70693,0x54DE5729,0x23D967BF,
-			0xB3667A2E,0xC4614AB8,0x5D681B02,0x2A6F2B94,0xB40BBE37,0xC30C8EA1,0x5A05DF1B,0x2D02EF8D
-		
+	// moves the content to allocated memory of at least size bytes
+	void spill(size_t size)
+	{
+		if (!spilled) {
+			external.reserve(size > 2 * inline_capacity ? size : 2 * inline_capacity);
+			external.assign(local.cbegin(), local.cbegin() + length);
+			spilled = true;
+		}
+		else
+			external.reserve(size);
+	}
 
-	};
+	std::array<char, inline_capacity>	local;
+	std::vector<char, _Alloc>			external;
+	size_t								length = 0;
+	bool								spilled = false;
 };
 
 
+/****t* tssi/section_filter
+*  NAME
+*    section_filter -- Mask/value filter on the first bytes of a section, like a DVB
+*    demux section filter. Index 0 refers to table_id, index i > 0 to byte i + 2 of
+*    the section (section_length is skipped), e.g. 1 and 2 to table_id_extension,
+*    3 to version_number/current_next_indicator and 4 to section_number. A section
+*    matches if (byte & mask[i]) == (value[i] & mask[i]) for all i.
+*  NOTES
+*    Bytes beyond the first transport packet of a section are not compared.
+*  SOURCE
+*/
+struct section_filter {
+	std::array<uint8_t, 16> value{};
+	std::array<uint8_t, 16> mask{};
+
+	section_filter() = default;
+
+	section_filter(uint_fast8_t table_id, uint_fast8_t table_id_mask = 0xff) noexcept
+	{
+		value[0] = static_cast<uint8_t>(table_id);
+		mask[0] = static_cast<uint8_t>(table_id_mask);
+	}
+
+	bool match(gsl::span<const char> section) const noexcept
+	{
+		for (std::ptrdiff_t i = 0; i < 16; ++i) {
+			if (mask[i] == 0)
+				continue;
+			const auto position = i == 0 ? 0 : i + 2;
+			if (position >= section.size())
+				break;
+			if ((static_cast<uint8_t>(section[position]) ^ value[i]) & mask[i])
+				return false;
+		}
+		return true;
+	}
+};
+/*******/
+
+
+/****t* tssi/psi_crc_policy_t
+*  NAME
+*    psi_crc_policy_t -- Handling of completed sections carrying a CRC_32 that fail
+*    the CRC check:
+*    - psi_crc_accept: store them anyway
+*    - psi_crc_protect: store them unless a valid version is cached
+*    - psi_crc_reject: discard them (default)
+*  NOTES
+*    Sections carry a CRC_32 if section_syntax_indicator == 0x1, and so does the
+*    time_offset_section (table_id 0x73). Other sections with
+*    section_syntax_indicator == 0x0, e.g. the time_date_section, are always stored.
+*  SOURCE
+*/
+enum psi_crc_policy_t : uint_fast8_t {
+	psi_crc_accept = 0x0,
+	psi_crc_protect = 0x1,
+	psi_crc_reject = 0x2
+};
+/*******/
+
+
 /****c* tssi/PSIHeap
 *  NAME
 *    PSIHeap -- Compiles transport packets to PSI sections, stores them and makes 
 *    them available. 
 *  NOTES
-*    Only current versions are stored. Old or future sections are discarded.
+*    Only current versions are stored. Old or future sections are discarded, as
+*    well as corrupt sections (see heap_crc_policy).
+*    Unchanged repetitions of cached sections are skipped without locking the cache.
+*    Completed sections are stored once per transport packet or, in batch mode, once
+*    per heap_commit (see heap_batch).
+*    Readers either lock the cache (lock_shared) or, without any locking, read
+*    snapshots (heap_snapshots, psi_snapshot).
+*    By default, sections are kept until heap_reset. See heap_budget,
+*    heap_retention and heap_expire_events to limit the memory used.
 *    Feed this class with transport packets or hand this job over to TSParser.
 *  DERIVED FROM
 *    ProcessNode
@@ -182,7 +297,26 @@ private:
 *  METHODS
 *    psi_heap
 *    heap_reset
+*    heap_crc_policy
+*    heap_filter
+*    heap_filter_reset
+*    heap_budget
+*    heap_retention
+*    heap_expire_events
+*    heap_descriptor_index
+*    heap_memory
+*    heap_batch
+*    heap_commit
+*    heap_save
+*    heap_load
+*    heap_snapshots
+*    psi_snapshot
 *    psi_callback
+*    psi_reset
+*    psi_table_callback
+*    psi_table_complete
+*    psi_delta_callback
+*    lock_shared
 *****/
 template <class _Alloc = std::allocator< char > >
 class PSIHeap : public ProcessNode {
@@ -197,6 +331,21 @@ public:
 		std::shared_lock<std::shared_mutex> lock(other.mutex);
 		heap = other.heap;
 		open_sections = other.open_sections;
+		crc_policy = other.crc_policy;
+		filters = other.filters;
+		budget = other.budget;
+		retention = other.retention;
+		retention_set = other.retention_set;
+		expire_events = other.expire_events;
+		batch = other.batch;
+		memory_bytes.store(heap.memory());
+		repeats = other.repeats;
+		repeats_generation = other.repeats_generation;
+		generation.store(other.generation.load());
+		table_states = other.table_states;
+		snapshots = other.snapshots;
+		snapshot = other.snapshot;
+		published = std::atomic_load(&other.published);
 	}
 
 	/****m* PSIHeap/psi_heap
@@ -204,18 +353,329 @@ public:
 	*    psi_heap -- Retrieve a reference to the PSI sections cache.
 	*  SYNOPSIS
 	*/
-	const std::map<section_identifier, PSISection<_Alloc>>& psi_heap() const noexcept
+	const PSIStore<_Alloc>& psi_heap() const noexcept
 	/*******/
 	{ return heap; }
 
 	/****m* PSIHeap/heap_reset
 	*  NAME
-	*    heap_reset -- Deletes all stored PSI sections.
+	*    heap_reset -- Deletes all stored PSI sections. Thread-safe, sections completed
+	*    by the processing thread meanwhile are discarded and not published.
 	*  SYNOPSIS
 	*/
 	void heap_reset() 
 	/*******/
-	{ std::unique_lock<std::shared_mutex> lock(mutex); heap.clear(); }
+	{
+		std::unique_lock<std::shared_mutex> lock(mutex);
+		heap.clear();
+		memory_bytes.store(0, std::memory_order_relaxed);
+		generation.fetch_add(1, std::memory_order_release); // invalidates repeats and snapshots
+		if (snapshots)
+			std::atomic_store(&published, std::make_shared<const PSISnapshot<_Alloc>>());
+	}
+
+	/****m* PSIHeap/heap_crc_policy
+	*  NAME
+	*    heap_crc_policy -- Sets the handling of sections failing the CRC check (see
+	*    psi_crc_policy_t).
+	*  SYNOPSIS
+	*/
+	void heap_crc_policy(psi_crc_policy_t policy) noexcept
+	/*******/
+	{ crc_policy = policy; }
+
+	/****m* PSIHeap/heap_filter
+	*  NAME
+	*    heap_filter -- Adds a section filter for pid. If filters are set for a PID,
+	*    only sections matching one of them are assembled and stored, others are
+	*    skipped without copying. Must not be called while the stream is processed.
+	*  SYNOPSIS
+	*/
+	void heap_filter(uint_fast16_t pid, const section_filter& filter)
+	/*******/
+	{ filters[pid].push_back(filter); }
+
+	/****m* PSIHeap/heap_filter_reset
+	*  NAME
+	*    heap_filter_reset -- Removes all section filters. Must not be called while the
+	*    stream is processed.
+	*  SYNOPSIS
+	*/
+	void heap_filter_reset() noexcept
+	/*******/
+	{ filters.clear(); }
+
+	/****m* PSIHeap/heap_budget
+	*  NAME
+	*    heap_budget -- Limits the bytes of all stored sections. If the budget is
+	*    exceeded, the least recently received sections are removed until 90 percent of
+	*    the budget are used. A removed section is stored again when it is received
+	*    the next time. 0 (default) means unlimited. Must not be called while the
+	*    stream is processed.
+	*  SYNOPSIS
+	*/
+	void heap_budget(size_t bytes) noexcept
+	/*******/
+	{ budget = bytes; }
+
+	/****m* PSIHeap/heap_retention
+	*  NAME
+	*    heap_retention -- Removes sections with a table_id from table_id_first to
+	*    table_id_last if they have not been received for max_age. Repetitions count
+	*    as received. 0 (default) keeps sections forever. Sections are checked once a
+	*    second. Must not be called while the stream is processed.
+	*  SYNOPSIS
+	*/
+	void heap_retention(uint_fast8_t table_id_first, uint_fast8_t table_id_last, std::chrono::seconds max_age)
+	/*******/
+	{
+		Expects(table_id_first <= table_id_last);
+		for (size_t table_id = table_id_first; table_id <= table_id_last; ++table_id)
+			retention[table_id] = max_age;
+		retention_set = std::any_of(retention.cbegin(), retention.cend(),
+			[](const std::chrono::seconds& age) { return age.count() > 0; });
+	}
+
+	/****m* PSIHeap/heap_expire_events
+	*  NAME
+	*    heap_expire_events -- Removes event information sections after all of their
+	*    events have ended. Repetitions of removed sections are not stored again, new
+	*    versions are. The stream time is taken from time and date or time offset
+	*    sections processed by this heap, without them no section expires. Sections
+	*    are checked once a second. Disabled by default. Must not be called while the
+	*    stream is processed.
+	*  SYNOPSIS
+	*/
+	void heap_expire_events(bool enable) noexcept
+	/*******/
+	{ expire_events = enable; }
+
+	/****m* PSIHeap/heap_descriptor_index
+	*  NAME
+	*    heap_descriptor_index -- Enables or disables indexing the descriptor loops of
+	*    completed sections (see DescriptorIndex, PSISection/descriptor_index).
+	*    Disabled by default. Must not be called while the stream is processed.
+	*  SYNOPSIS
+	*/
+	void heap_descriptor_index(bool enable) noexcept
+	/*******/
+	{ index_descriptors = enable; }
+
+	/****m* PSIHeap/heap_memory
+	*  NAME
+	*    heap_memory -- Returns the bytes allocated for stored sections, excluding
+	*    snapshots. Thread-safe.
+	*  SYNOPSIS
+	*/
+	size_t heap_memory() const noexcept
+	/*******/
+	{ return memory_bytes.load(std::memory_order_relaxed); }
+
+	/****m* PSIHeap/heap_batch
+	*  NAME
+	*    heap_batch -- Enables or disables batch mode. By default, completed sections
+	*    are stored and callbacks are called after each transport packet. In batch
+	*    mode, sections are staged until heap_commit, then stored under a single lock
+	*    and published in a single snapshot, followed by the callbacks. Repetitions
+	*    of staged sections are skipped. Must not be called while the stream is
+	*    processed.
+	*  NOTES
+	*    With TSParser, commit after each buffer:
+	*      parser.pid_commit([&heap]() { heap.heap_commit(); });
+	*  SYNOPSIS
+	*/
+	void heap_batch(bool enable)
+	/*******/
+	{
+		if (batch && !enable)
+			flush();
+		batch = enable;
+	}
+
+	/****m* PSIHeap/heap_commit
+	*  NAME
+	*    heap_commit -- Stores the sections staged in batch mode and calls back. Call
+	*    from the thread processing the stream.
+	*  SYNOPSIS
+	*/
+	void heap_commit()
+	/*******/
+	{ flush(); }
+
+	/****m* PSIHeap/heap_save
+	*  NAME
+	*    heap_save -- Writes all stored sections to a file, see heap_load. Returns false
+	*    on failure. Thread-safe.
+	*  NOTES
+	*    File format (version 1, little-endian):
+	*    - "TSSIPSI" 0x00, uint32 format version, uint32 number of sections
+	*    - per section: uint32 key (table_id << 24 | table_id_extension << 8 |
+	*      section_number), uint32 file offset, uint32 size, uint32 flags (bit 0: CRC
+	*      valid, informational, heap_load checks the CRC again); ordered by key
+	*    - section data
+	*    The cache is locked while the file content is copied, not while it is
+	*    written.
+	*  SYNOPSIS
+	*/
+	bool heap_save(const std::string& path) const
+	/*******/
+	{
+		std::vector<char> buffer;
+		{
+			std::shared_lock<std::shared_mutex> lock(mutex);
+			size_t offset = 16 + heap.size() * 16;
+			buffer.reserve(offset + heap.section_bytes());
+			buffer.insert(buffer.end(), file_magic, file_magic + 8);
+			put32(buffer, file_version);
+			put32(buffer, static_cast<uint_fast32_t>(heap.size()));
+
+			for (const auto& section : heap) {
+				put32(buffer, PSIStore<_Alloc>::store_key(section.first));
+				put32(buffer, static_cast<uint_fast32_t>(offset));
+				put32(buffer, static_cast<uint_fast32_t>(section.second.psi_data().size()));
+				put32(buffer, section.second.crc32() ? 0x1 : 0x0);
+				offset += static_cast<size_t>(section.second.psi_data().size());
+			}
+			for (const auto& section : heap) {
+				const auto data = section.second.psi_data();
+				buffer.insert(buffer.end(), data.cbegin(), data.cend());
+			}
+		}
+
+		const std::string temporary = path + ".tmp";
+		{
+			std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+			if (!file)
+				return false;
+			file.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+			if (!file.flush()) {
+				file.close();
+				std::remove(temporary.c_str());
+				return false;
+			}
+		}
+
+		if (std::rename(temporary.c_str(), path.c_str()) != 0) {
+			std::remove(path.c_str()); // required on some platforms
+			if (std::rename(temporary.c_str(), path.c_str()) != 0) {
+				std::remove(temporary.c_str());
+				return false;
+			}
+		}
+		return true;
+	}
+
+	/****m* PSIHeap/heap_load
+	*  NAME
+	*    heap_load -- Replaces all stored sections by the sections of a file written by
+	*    heap_save. The file is memory-mapped and sections are served from the mapping
+	*    until newer versions are received. No callbacks are called. Returns false and
+	*    leaves the heap unchanged if the file is missing or invalid. The CRC of each
+	*    section is verified and heap_crc_policy applies as for received sections.
+	*    Must not be called while the stream is processed.
+	*  SYNOPSIS
+	*/
+	bool heap_load(const std::string& path)
+	/*******/
+	{
+		auto file = std::make_shared<const MappedFile>(path);
+		const auto data = file->file_data();
+
+		// validate
+		if (data.size() < 16 || !std::equal(file_magic, file_magic + 8, data.cbegin()) ||
+			get32(data, 8) != file_version)
+			return false;
+		const size_t count = get32(data, 12);
+		if (count > static_cast<size_t>(data.size() - 16) / 16)
+			return false;
+		std::vector<bool> crc_valid(count);
+		for (size_t i = 0; i < count; ++i) {
+			const auto entry = data.subspan(16 + i * 16, 16);
+			const size_t offset = get32(entry, 4);
+			const size_t size = get32(entry, 8);
+			if (size < 8 || offset > static_cast<size_t>(data.size()) || size > static_cast<size_t>(data.size()) - offset)
+				return false;
+			const auto section = data.subspan(offset, size);
+			if (static_cast<size_t>(iso138181::private_section::section_length(section)) + 3 != size ||
+				static_cast<uint_fast32_t>(iso138181::private_section::table_id(section)) != (get32(entry, 0) >> 24) ||
+				(i > 0 && get32(entry, 0) <= get32(data.subspan(i * 16, 16), 0)))
+				return false;
+			crc_valid[i] = section.size() >= 12 && crc32_mpeg2(section) == 0; // the file's flag is not trusted
+		}
+
+		// replace
+		{
+			std::unique_lock<std::shared_mutex> lock(mutex);
+			heap.clear();
+			heap.mapping = file;
+			for (size_t i = 0; i < count; ++i) {
+				const auto entry = data.subspan(16 + i * 16, 16);
+				const auto section = data.subspan(get32(entry, 4), get32(entry, 8));
+				if (!crc_valid[i] && crc_policy == psi_crc_reject && crc_carried(section))
+					continue; // corrupt
+				heap.assign_mapped(unpack_key(get32(entry, 0)), section, crc_valid[i]);
+			}
+			heap.merge();
+			if (index_descriptors) {
+				for (auto& section : heap.entries)
+					section.second.descriptors = std::make_shared<const DescriptorIndex>(section.second.view);
+			}
+			memory_bytes.store(heap.memory(), std::memory_order_relaxed);
+		}
+
+		open_sections.clear();
+		repeats.clear();
+		table_states.clear();
+		for (const auto& section : heap) {
+			const bool syntax = iso138181::private_section::section_syntax_indicator(section.second.psi_data());
+			remember(section.second, section.second.psi_data(), syntax);
+			track(section.second, section.second.psi_data());
+		}
+
+		if (snapshots)
+			heap_snapshots(true);
+		return true;
+	}
+
+	/****m* PSIHeap/heap_snapshots
+	*  NAME
+	*    heap_snapshots -- Enables or disables the publication of snapshots (see
+	*    psi_snapshot). Disabled by default. Must not be called while the stream is
+	*    processed.
+	*  SYNOPSIS
+	*/
+	void heap_snapshots(bool enable)
+	/*******/
+	{
+		snapshots = enable;
+		snapshot.reset();
+		pending_tables.clear();
+		pending = false;
+		if (enable) {
+			snapshot = std::make_shared<const PSISnapshot<_Alloc>>();
+			std::shared_lock<std::shared_mutex> lock(mutex);
+			for (const auto& section : heap) {
+				auto& table = pending_tables[table_key(std::get<0>(section.first), std::get<1>(section.first))];
+				if (!table)
+					table = std::make_shared<snapshot_table>();
+				table->push_back(snapshot_section(section.second.psi_data(), section.second));
+			}
+			snapshot = next_snapshot();
+		}
+		std::atomic_store(&published, snapshot);
+	}
+
+	/****m* PSIHeap/psi_snapshot
+	*  NAME
+	*    psi_snapshot -- Returns the latest snapshot of the PSI sections cache. Sections
+	*    are published after the transport packet completing them was processed. The
+	*    pointer is empty if snapshots are disabled. Thread-safe, no locking of the
+	*    cache required.
+	*  SYNOPSIS
+	*/
+	std::shared_ptr<const PSISnapshot<_Alloc>> psi_snapshot() const
+	/*******/
+	{ return std::atomic_load(&published); }
 
 	/****m* PSIHeap/psi_callback
 	*  NAME
@@ -227,9 +687,98 @@ public:
 	/*******/
 	{ transfer_callback = cb; }
 
+	/****m* PSIHeap/psi_callback
+	*  NAME
+	*    psi_callback -- Establish a callback, called when a new section with a
+	*    table_id from table_id_first to table_id_last becomes available. Optionally,
+	*    only sections with (table_id_extension & extension_mask) == 
+	*    (extension & extension_mask) are delivered. Multiple callbacks are possible.
+	*  SYNOPSIS
+	*/
+	void psi_callback(uint_fast8_t table_id_first, uint_fast8_t table_id_last,
+		std::function< void(const section_identifier&) >&& cb)
+	/*******/
+	{ psi_callback(table_id_first, table_id_last, 0, 0, std::move(cb)); }
+
+	void psi_callback(uint_fast8_t table_id_first, uint_fast8_t table_id_last,
+		uint_fast16_t extension, uint_fast16_t extension_mask,
+		std::function< void(const section_identifier&) >&& cb)
+	{
+		Expects(table_id_first <= table_id_last);
+
+		subscription sub;
+		sub.extension = extension & extension_mask;
+		sub.extension_mask = extension_mask;
+		sub.callback = cb;
+		subscriptions.push_back(std::move(sub));
+		for (size_t table_id = table_id_first; table_id <= table_id_last; ++table_id)
+			subscribers[table_id].push_back(subscriptions.size() - 1);
+	}
+
+	/****m* PSIHeap/psi_reset
+	*  NAME
+	*    psi_reset -- Clears all callbacks established with psi_callback and
+	*    psi_delta_callback.
+	*  SYNOPSIS
+	*/
+	void psi_reset() noexcept
+	/*******/
+	{
+		transfer_callback = nullptr;
+		delta_callback = nullptr;
+		subscriptions.clear();
+		for (auto& table : subscribers)
+			table.clear();
+	}
+
+	/****m* PSIHeap/psi_table_callback
+	*  NAME
+	*    psi_table_callback -- Establish a callback, called once when all sections of a
+	*    table version are available and whenever a section of a complete table
+	*    changes. Complete means all sections 0 to last_section_number or, for event
+	*    information tables, all sections of all segments up to
+	*    segment_last_section_number. Tables with section_syntax_indicator == 0x0
+	*    consist of a single section.
+	*  SYNOPSIS
+	*/
+	void psi_table_callback(std::function< void(const table_identifier&) >&& cb)
+	/*******/
+	{ table_callback = cb; }
+
+	/****m* PSIHeap/psi_table_complete
+	*  NAME
+	*    psi_table_complete -- Returns true if all sections of the current version of
+	*    the table are available (see psi_table_callback). Call from the thread
+	*    processing the stream, e.g. within callbacks.
+	*  SYNOPSIS
+	*/
+	bool psi_table_complete(const table_identifier& table) const
+	/*******/
+	{
+		auto state = table_states.find(table_key(std::get<0>(table), std::get<1>(table)));
+		return state != table_states.end() && state->second.complete;
+	}
+
+	/****m* PSIHeap/psi_delta_callback
+	*  NAME
+	*    psi_delta_callback -- Establish a callback, called for every added, removed or
+	*    changed loop entry when a program map, service description or event
+	*    information section is stored (see section_delta). The first version of a
+	*    section adds all its entries. Called before psi_callback for the section.
+	*  NOTES
+	*    Sections removed by heap_reset, heap_budget or expiry do not report their
+	*    entries as removed.
+	*  SYNOPSIS
+	*/
+	void psi_delta_callback(std::function< void(const section_identifier&, const loop_delta&) >&& cb)
+	/*******/
+	{ delta_callback = cb; }
+
 	/****m* PSIHeap/lock_shared
 	*  NAME
-	*    lock_shared -- Locks the PSI sections cache for thread shared read access.
+	*    lock_shared -- Locks the PSI sections cache for thread shared read access. The
+	*    thread processing the stream waits while the lock is held, consider
+	*    psi_snapshot for long running readers.
 	*  SYNOPSIS
 	*/
 	std::shared_lock<std::shared_mutex> lock_shared()
@@ -240,7 +789,37 @@ public:
 	}
 
 private:
+	using snapshot_table = typename PSISnapshot<_Alloc>::table_type;
+
 	void process(gsl::span<const char> data)
+	{
+		const auto current_generation = generation.load(std::memory_order_acquire);
+		if (repeats_generation != current_generation) {
+			// heap was reset
+			repeats.clear();
+			table_states.clear();
+			pending_tables.clear();
+			pending = false;
+			if (snapshots) {
+				// the empty snapshot published by heap_reset
+				std::shared_lock<std::shared_mutex> lock(mutex);
+				snapshot = std::atomic_load(&published);
+			}
+			stream_time = 0;
+			staged.clear();
+			repeats_generation = current_generation;
+		}
+
+		if (budget > 0 || expire_events || retention_set)
+			now = std::chrono::steady_clock::now();
+
+		assemble(data);
+
+		if (!batch)
+			flush();
+	}
+
+	void assemble(gsl::span<const char> data)
 	{
 		Expects(data.size() == 188);
 
@@ -271,28 +850,21 @@ private:
 			++payload;
 		}
 
-		if (open_sections.find(pid) != open_sections.end()) {
+		auto assembling = open_sections.find(pid);
+		if (assembling != open_sections.end() && assembling->second.section_length > 0) {
 			if (!payload_unit_start_indicator(data) || pointer_field > 0) {
+				auto& section = assembling->second;
 
 				if (pointer_field > 0)
-					std::copy(payload, payload + pointer_field, std::back_inserter(open_sections[pid].section_data));
-				else if (open_sections[pid].psi_data().sizechars() + (data.cend() - payload) <= static_cast<signed>(open_sections[pid].sizechars()))
-					std::copy(payload, data.cend(), std::back_inserter(open_sections[pid].section_data));
+					section.section_data.append(payload, payload + pointer_field);
+				else if (static_cast<ptrdiff_t>(section.section_data.size()) + (data.cend() - payload) <= section.section_length)
+					section.section_data.append(payload, data.cend());
 				else
-					std::copy(payload, payload + (open_sections[pid].sizechars() - open_sections[pid].psi_data().size()), std::back_inserter(open_sections[pid].section_data));
+					section.section_data.append(payload, payload + (section.section_length - static_cast<ptrdiff_t>(section.section_data.size())));
 
-				if (open_sections[pid].sizechars() == open_sections[pid].psi_data().size()) {
+				if (static_cast<ptrdiff_t>(section.section_data.size()) == section.section_length) {
 					// finished
-					const auto heap_key = open_sections[pid].section_key();
-					{
-						std::unique_lock<std::shared_mutex> lock(mutex);
-						heap[heap_key] = std::move(open_sections[pid]);
-					}
-					open_sections.erase(pid);
-
-					if (transfer_callback)
-						transfer_callback(heap_key);
-
+					complete(pid);
 				}
 			}
 		}
@@ -322,44 +894,33 @@ private:
 				if (section_syntax_indicator_ && !current_next_indicator(data_section)) // future data
 					goto nocaching;
 
-				{
-					std::shared_lock<std::shared_mutex> lock(mutex);
-					if (heap.find(heap_key) != heap.end())
-					{
-						// section already cached
-						if (section_syntax_indicator_ ? version_number(data_section) : 0 == // equal version?
-							section_syntax_indicator(heap[heap_key].psi_data()) ? version_number(heap[heap_key].psi_data()) : 0)
-							goto nocaching;
-					} // else: section not cached
-				}
+				if (!accepted(pid, data_section))
+					goto nocaching; // filtered
+
+				if (repeated(heap_key, data_section))
+					goto nocaching; // section already cached
 
 				// caching:
 				// we need this section
-				open_sections[pid] = PSISection<_Alloc>();
-
-				open_sections[pid].section_length = section_length(data_section) + 3;
-				open_sections[pid].section_data.reserve(open_sections[pid].sizechars());
-				open_sections[pid].heap_key = heap_key;
-
-				if ((data.cend() - payload) < static_cast<signed>(open_sections[pid].sizechars())) {
-					std::copy(payload, data.cend(), std::back_inserter(open_sections[pid].section_data));
-					break; // we won't complete the section in this packet
-				}
-				else {
-					std::copy(payload, payload + open_sections[pid].sizechars(), std::back_inserter(open_sections[pid].section_data));
-					payload += open_sections[pid].sizechars();
+				{
+					auto& section = open_sections[pid];
+					section.clear();
+					section.section_length = section_length(data_section) + 3;
+					section.section_data.reserve(static_cast<size_t>(section.section_length));
+					section.heap_key = heap_key;
 
-					// finished
-					{
-						std::unique_lock<std::shared_mutex> lock(mutex);
-						heap[heap_key] = std::move(open_sections[pid]);
+					if ((data.cend() - payload) < section.section_length) {
+						section.section_data.append(payload, data.cend());
+						break; // we won't complete the section in this packet
 					}
-					open_sections.erase(pid);
-
-					if (transfer_callback)
-						transfer_callback(heap_key);
+					else {
+						section.section_data.append(payload, payload + section.section_length);
+						payload += section.section_length;
 
-					continue;
+						// finished
+						complete(pid);
+						continue;
+					}
 				}
 
 
@@ -383,11 +944,564 @@ private:
 	}
 
 
-	std::map<section_identifier, PSISection<_Alloc>>	heap; // storage
-	std::map<uint_fast16_t, PSISection<_Alloc>>			open_sections; // PID -> data
+	// state of a cached section, owned by the thread calling process
+	struct repeat_entry {
+		uint_fast8_t							version_number = 0;
+		uint_fast32_t							crc = 0;
+		bool									valid = false; // CRC check passed
+		bool									expired = false; // removed by heap_expire_events
+		std::chrono::steady_clock::time_point	last_seen;
+		time_t									events_end = 0; // event information only
+	};
+
+	static section_identifier unpack_key(uint_fast32_t key) noexcept
+	{
+		return std::make_tuple(static_cast<uint_fast8_t>(key >> 24),
+			static_cast<uint_fast16_t>((key >> 8) & 0xffff), static_cast<uint_fast8_t>(key & 0xff));
+	}
+
+	static uint_fast32_t crc_field(gsl::span<const char> section) noexcept
+	{
+		const auto crc = section.last(4);
+		return (static_cast<uint_fast32_t>(static_cast<unsigned char>(crc[0])) << 24) |
+			(static_cast<uint_fast32_t>(static_cast<unsigned char>(crc[1])) << 16) |
+			(static_cast<uint_fast32_t>(static_cast<unsigned char>(crc[2])) << 8) |
+			static_cast<uint_fast32_t>(static_cast<unsigned char>(crc[3]));
+	}
+
+	// true, if no section filter is set for pid or one matches
+	bool accepted(uint_fast16_t pid, gsl::span<const char> data_section) const noexcept
+	{
+		if (filters.empty())
+			return true;
+		auto pid_filters = filters.find(pid);
+		if (pid_filters == filters.end())
+			return true;
+		for (const auto& filter : pid_filters->second) {
+			if (filter.match(data_section))
+				return true;
+		}
+		return false;
+	}
+
+	// true, if the section starting at data_section is a repetition of a valid,
+	// cached section. Decided without locking the heap.
+	bool repeated(const section_identifier& key, gsl::span<const char> data_section)
+	{
+		using namespace iso138181::private_section_syntax;
+
+		const auto entry = repeats.find(PSIStore<_Alloc>::store_key(key));
+		if (entry == repeats.end() || !entry->second.valid)
+			return false;
+
+		const bool syntax = section_syntax_indicator(data_section);
+		if (syntax && version_number(data_section) != entry->second.version_number)
+			return false;
+
+		// compare CRCs if the section is complete, required without syntax
+		bool repetition = syntax;
+		const auto length = static_cast<std::ptrdiff_t>(section_length(data_section)) + 3;
+		if (length >= 12 && length <= data_section.size())
+			repetition = crc_field(data_section.first(length)) == entry->second.crc;
+
+		if (repetition)
+			entry->second.last_seen = now;
+		return repetition;
+	}
+
+	static constexpr char file_magic[8] = { 'T', 'S', 'S', 'I', 'P', 'S', 'I', '\0' };
+	static constexpr uint_fast32_t file_version = 1;
+
+	static void put32(std::vector<char>& buffer, uint_fast32_t value)
+	{
+		for (int i = 0; i < 4; ++i)
+			buffer.push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+	}
+
+	static uint_fast32_t get32(gsl::span<const char> data, std::ptrdiff_t offset) noexcept
+	{
+		uint_fast32_t value = 0;
+		for (int i = 3; i >= 0; --i)
+			value = (value << 8) | static_cast<unsigned char>(data[offset + i]);
+		return value;
+	}
+
+	// records a stored section for repeated() and expiry
+	void remember(const PSISection<_Alloc>& section, gsl::span<const char> data, bool syntax)
+	{
+		const auto table_id_ = std::get<0>(section.heap_key);
+
+		repeat_entry entry;
+		entry.valid = section.crc32();
+		entry.version_number = syntax ? iso138181::private_section_syntax::version_number(data) : 0;
+		entry.crc = entry.valid ? crc_field(data) : 0;
+		entry.last_seen = now;
+
+		if (entry.valid && table_id_ >= 0x4e && table_id_ <= 0x6f) {
+			using namespace etsi300468::event_information_section;
+			// bounds checked walk, event_info_loop would not tolerate malformed sections
+			for (std::ptrdiff_t offset = 14; offset + 12 <= data.size() - 4; ) {
+				const validated_span<12> loop(data.subspan(offset, data.size() - 4 - offset));
+				const auto size = static_cast<std::ptrdiff_t>(loop::descriptors_loop_length(loop)) + 12;
+				if (offset + size > data.size() - 4)
+					break;
+				offset += size;
+				if (std::all_of(loop.data() + 2, loop.data() + 7, [](char c) { return c == static_cast<char>(0xff); }))
+					continue; // undefined start_time
+				const auto end = loop::start_time(loop) + static_cast<time_t>(loop::duration(loop).count());
+				entry.events_end = end > entry.events_end ? end : entry.events_end;
+			}
+		}
+		else if ((table_id_ == 0x70 || table_id_ == 0x73) && data.size() >= 8) {
+			stream_time = etsi300468::time_date_section::UTC_time(data);
+		}
+
+		repeats[PSIStore<_Alloc>::store_key(section.heap_key)] = entry;
+	}
+
+	size_t section_bytes() const
+	{
+		std::shared_lock<std::shared_mutex> lock(mutex);
+		return heap.section_bytes();
+	}
+
+	// removes aged and expired sections
+	void prune()
+	{
+		last_prune = now;
+
+		std::vector<section_identifier> aged, ended;
+		for (const auto& entry : repeats) {
+			if (entry.second.expired)
+				continue;
+			const auto max_age = retention[entry.first >> 24];
+			if (max_age.count() > 0 && now - entry.second.last_seen > max_age)
+				aged.push_back(unpack_key(entry.first));
+			else if (expire_events && stream_time != 0 && entry.second.events_end != 0 &&
+				entry.second.events_end <= stream_time)
+				ended.push_back(unpack_key(entry.first));
+		}
+
+		remove(aged, false);
+		remove(ended, true);
+	}
+
+	// removes the least recently received sections until 90 percent of the budget are used
+	void evict()
+	{
+		std::vector<std::pair<std::chrono::steady_clock::time_point, uint_fast32_t>> candidates;
+		candidates.reserve(repeats.size());
+		for (const auto& entry : repeats) {
+			if (!entry.second.expired)
+				candidates.emplace_back(entry.second.last_seen, entry.first);
+		}
+		std::sort(candidates.begin(), candidates.end());
+
+		std::vector<section_identifier> keys;
+		{
+			std::shared_lock<std::shared_mutex> lock(mutex);
+			size_t bytes = heap.section_bytes();
+			for (const auto& candidate : candidates) {
+				if (bytes <= budget - budget / 10)
+					break;
+				const auto key = unpack_key(candidate.second);
+				auto section = heap.find(key);
+				if (section == heap.end())
+					continue;
+				bytes -= static_cast<size_t>(section->second.psi_data().size());
+				keys.push_back(key);
+			}
+		}
+
+		remove(keys, false);
+	}
+
+	// removes sections from the heap, repetitions of expired ones are skipped
+	void remove(const std::vector<section_identifier>& keys, bool expired)
+	{
+		if (keys.empty())
+			return;
+
+		{
+			std::unique_lock<std::shared_mutex> lock(mutex);
+			for (const auto& key : keys)
+				heap.erase(key);
+			memory_bytes.store(heap.memory(), std::memory_order_relaxed);
+		}
+
+		for (const auto& key : keys) {
+			if (expired)
+				repeats[PSIStore<_Alloc>::store_key(key)].expired = true;
+			else {
+				repeats.erase(PSIStore<_Alloc>::store_key(key));
+				auto state = table_states.find(table_key(std::get<0>(key), std::get<1>(key)));
+				if (state != table_states.end()) {
+					state->second.received.reset(std::get<2>(key));
+					state->second.complete = false;
+				}
+			}
+			if (snapshots)
+				snapshot_erase(key);
+		}
+	}
+
+	// stages a completed open section for commit(), if it passes the CRC policy
+	void complete(uint_fast16_t pid)
+	{
+		auto& assembled = open_sections[pid];
+		const gsl::span<const char> data = assembled.section_data;
+
+		staged_section entry;
+		auto& section = entry.section;
+		section.section_length = assembled.section_length;
+		section.heap_key = assembled.heap_key;
+		section.crc_valid = data.size() >= 12 && crc32_mpeg2(data) == 0;
+
+		const bool syntax = iso138181::private_section::section_syntax_indicator(data);
+		bool store = section.crc32() || crc_policy == psi_crc_accept || !crc_carried(data);
+		if (!store && crc_policy == psi_crc_protect) {
+			auto cached = repeats.find(PSIStore<_Alloc>::store_key(section.heap_key));
+			store = cached == repeats.end() || !cached->second.valid || cached->second.expired;
+		}
+
+		if (store) {
+			if (index_descriptors)
+				section.descriptors = std::make_shared<const DescriptorIndex>(data);
+			remember(section, data, syntax);
+			if (snapshots)
+				snapshot_assign(section, data);
+
+			entry.table_complete = track(section, data);
+			entry.section_data = std::move(assembled.section_data);
+			staged.push_back(std::move(entry));
+		}
+		assembled.clear(); // kept for the next section of pid
+	}
+
+	// moves the staged sections to the heap under one lock, then calls back
+	void commit()
+	{
+		if (staged.empty())
+			return;
+
+		{
+			std::unique_lock<std::shared_mutex> lock(mutex);
+			if (generation.load(std::memory_order_relaxed) != repeats_generation) {
+				staged.clear(); // heap_reset by another thread meanwhile
+				return;
+			}
+			for (auto& entry : staged) {
+				if (delta_callback && delta_supported(std::get<0>(entry.section.heap_key))) {
+					// the previous version is overwritten in place
+					// the index is merged after the batch, look up by hash
+					const auto& key = entry.section.heap_key;
+					const auto previous = heap.count(key) ? heap.at(key).psi_data() : gsl::span<const char>();
+					entry.previous.assign(previous.cbegin(), previous.cend());
+				}
+				heap.assign(entry.section, entry.section_data);
+			}
+			heap.merge();
+			memory_bytes.store(heap.memory(), std::memory_order_relaxed);
+		}
+
+		// callbacks may process data, take the staged sections
+		std::vector<staged_section> committed;
+		committed.swap(staged);
+
+		for (const auto& entry : committed) {
+			const auto& heap_key = entry.section.heap_key;
+
+			if (delta_callback && delta_supported(std::get<0>(heap_key))) {
+				section_delta(entry.previous, entry.section_data, [this, &heap_key](const loop_delta& delta) {
+					delta_callback(heap_key, delta);
+				});
+			}
+
+			if (transfer_callback)
+				transfer_callback(heap_key);
+
+			// subscriptions may be added by callbacks, use indices
+			const auto table_id_ = std::get<0>(heap_key);
+			for (size_t i = 0, n = subscribers[table_id_].size(); i < n; ++i) {
+				const auto& sub = subscriptions[subscribers[table_id_][i]];
+				if ((std::get<1>(heap_key) & sub.extension_mask) == sub.extension)
+					sub.callback(heap_key);
+			}
+
+			if (entry.table_complete && table_callback)
+				table_callback(table_identifier(std::get<0>(heap_key), std::get<1>(heap_key)));
+		}
+
+		if (budget > 0 && section_bytes() > budget)
+			evict();
+
+		committed.clear();
+		if (staged.empty())
+			staged.swap(committed); // keep the capacity
+	}
+
+	// commits staged sections, removes expired ones and publishes a snapshot
+	void flush()
+	{
+		commit();
+
+		if ((budget > 0 || expire_events || retention_set) && now - last_prune >= std::chrono::seconds(1))
+			prune();
+
+		if (pending)
+			publish();
+	}
+
+	// section being assembled, kept per PID and reused
+	struct open_section {
+		section_buffer<_Alloc>	section_data;
+		ptrdiff_t				section_length = 0; // 0 if no section is open
+		section_identifier		heap_key;
+
+		void clear() noexcept
+		{
+			section_data.clear();
+			section_length = 0;
+		}
+	};
+
+	// completed section waiting for commit()
+	struct staged_section {
+		PSISection<_Alloc>		section; // without data
+		section_buffer<_Alloc>	section_data;
+		bool					table_complete = false;
+		std::vector<char>		previous; // previous version, psi_delta_callback only
+	};
+
+	// filtered psi_callback
+	struct subscription {
+		uint_fast16_t										extension = 0;
+		uint_fast16_t										extension_mask = 0;
+		std::function< void(const section_identifier&) >	callback;
+	};
+
+	// completion state of a table version
+	struct table_state {
+		uint_fast8_t					version_number = 0;
+		uint_fast8_t					last_section_number = 0;
+		bool							complete = false;
+		std::bitset<256>				received;
+		std::array<uint_fast8_t, 32>	segment_last_section_number{}; // event information only
+	};
+
+	// sections with a CRC_32, see psi_crc_policy_t
+	static bool crc_carried(gsl::span<const char> section) noexcept
+	{
+		return iso138181::private_section::section_syntax_indicator(section) ||
+			iso138181::private_section::table_id(section) == 0x73;
+	}
+
+	// tables with loop entries compared by section_delta
+	static bool delta_supported(uint_fast8_t table_id) noexcept
+	{ return table_id == 0x02 || table_id == 0x42 || table_id == 0x46 || (table_id >= 0x4e && table_id <= 0x6f); }
+
+	static uint_fast32_t table_key(uint_fast8_t table_id, uint_fast16_t table_id_extension) noexcept
+	{ return (static_cast<uint_fast32_t>(table_id) << 16) | table_id_extension; }
+
+	// updates the table of a stored section, true if the table is complete
+	bool track(const PSISection<_Alloc>& section, gsl::span<const char> data)
+	{
+		using namespace iso138181::private_section_syntax;
+
+		if (!section_syntax_indicator(data))
+			return true; // single section
+
+		const auto table_id_ = std::get<0>(section.heap_key);
+		auto& state = table_states[table_key(table_id_, std::get<1>(section.heap_key))];
+		if (state.received.none() || state.version_number != version_number(data) ||
+			state.last_section_number != last_section_number(data)) {
+			// new table version
+			state = table_state();
+			state.version_number = version_number(data);
+			state.last_section_number = last_section_number(data);
+		}
+
+		const auto section_number_ = section_number(data);
+		state.received.set(section_number_);
+
+		const bool segmented = table_id_ >= 0x4e && table_id_ <= 0x6f;
+		if (segmented)
+			state.segment_last_section_number[section_number_ / 8] =
+				etsi300468::event_information_section::segment_last_section_number(data);
+
+		state.complete = true;
+		for (size_t first = 0; first <= state.last_section_number && state.complete; first += 8) {
+			size_t last = first + 7 < state.last_section_number ? first + 7 : state.last_section_number;
+			if (segmented) {
+				// one section of the segment at least, sections up to segment_last_section_number
+				bool any = false;
+				for (size_t i = first; i <= last; ++i)
+					any = any || state.received.test(i);
+				const size_t segment_last = state.segment_last_section_number[first / 8];
+				if (!any)
+					state.complete = false;
+				else if (segment_last >= first && segment_last < last)
+					last = segment_last;
+			}
+			for (size_t i = first; i <= last && state.complete; ++i)
+				state.complete = state.received.test(i);
+		}
+		return state.complete;
+	}
+
+	// immutable copy of a section
+	static std::shared_ptr<const PSISection<_Alloc>> snapshot_section(gsl::span<const char> data, const PSISection<_Alloc>& section)
+	{
+		auto copy = std::make_shared<PSISection<_Alloc>>();
+		copy->section_data.assign(data.cbegin(), data.cend());
+		copy->view = copy->section_data;
+		copy->section_length = section.section_length;
+		copy->heap_key = section.heap_key;
+		copy->crc_valid = section.crc_valid;
+		copy->descriptors = section.descriptors;
+		return copy;
+	}
+
+	// the pending copy of a table, copied from the last snapshot on first use
+	std::shared_ptr<snapshot_table>& pending_table(uint_fast8_t table_id, uint_fast16_t table_id_extension)
+	{
+		auto& table = pending_tables[table_key(table_id, table_id_extension)];
+		if (!table) {
+			const auto published_table = snapshot->lookup(table_identifier(table_id, table_id_extension));
+			table = published_table ? std::make_shared<snapshot_table>(*published_table) : std::make_shared<snapshot_table>();
+		}
+		return table;
+	}
+
+	// copy on write of the table of section, published by publish()
+	void snapshot_assign(const PSISection<_Alloc>& section, gsl::span<const char> data)
+	{
+		auto& table = pending_table(std::get<0>(section.heap_key), std::get<1>(section.heap_key));
+
+		auto copy = snapshot_section(data, section);
+		auto it = std::lower_bound(table->begin(), table->end(), section.heap_key, PSISnapshot<_Alloc>::key_less);
+		if (it != table->end() && (*it)->section_key() == section.heap_key)
+			*it = std::move(copy);
+		else
+			table->insert(it, std::move(copy));
+		pending = true;
+	}
+
+	void snapshot_erase(const section_identifier& key)
+	{
+		const auto table_id = std::get<0>(key);
+		const auto table_id_extension = std::get<1>(key);
+		if (!pending_tables.count(table_key(table_id, table_id_extension)) &&
+			!snapshot->lookup(table_identifier(table_id, table_id_extension)))
+			return;
+
+		auto& table = pending_table(table_id, table_id_extension);
+		auto it = std::lower_bound(table->begin(), table->end(), key, PSISnapshot<_Alloc>::key_less);
+		if (it != table->end() && (*it)->section_key() == key) {
+			table->erase(it);
+			pending = true;
+		}
+	}
+
+	// the last snapshot with the pending tables applied, shares all other tables
+	std::shared_ptr<const PSISnapshot<_Alloc>> next_snapshot()
+	{
+		using table_list = typename PSISnapshot<_Alloc>::table_list;
+
+		auto next = std::make_shared<PSISnapshot<_Alloc>>(*snapshot);
+		auto pending_ = pending_tables.begin(); // ordered by table_id, table_id_extension
+		while (pending_ != pending_tables.end()) {
+			const auto table_id = static_cast<uint_fast8_t>(pending_->first >> 16);
+			auto id = std::lower_bound(next->tables.begin(), next->tables.end(), table_id, PSISnapshot<_Alloc>::table_id_less);
+			const bool id_found = id != next->tables.end() && id->table_id == table_id;
+			auto tables = id_found ? std::make_shared<table_list>(*id->tables) : std::make_shared<table_list>();
+
+			for (; pending_ != pending_tables.end() && (pending_->first >> 16) == table_id; ++pending_) {
+				const auto table_id_extension = static_cast<uint_fast16_t>(pending_->first & 0xffff);
+				auto& sections = pending_->second;
+				auto entry = std::lower_bound(tables->begin(), tables->end(), table_id_extension, PSISnapshot<_Alloc>::extension_less);
+				const bool found = entry != tables->end() && entry->table_id_extension == table_id_extension;
+
+				next->section_count -= found ? entry->sections->size() : 0;
+				next->section_count += sections->size();
+				if (sections->empty()) {
+					if (found)
+						tables->erase(entry);
+				}
+				else if (found)
+					entry->sections = std::move(sections);
+				else
+					tables->insert(entry, { table_id_extension, std::move(sections) });
+			}
+
+			if (tables->empty()) {
+				if (id_found)
+					next->tables.erase(id);
+			}
+			else if (id_found)
+				id->tables = std::move(tables);
+			else
+				next->tables.insert(id, { table_id, std::move(tables) });
+		}
+		pending_tables.clear();
+		pending = false;
+		return next;
+	}
+
+	void publish()
+	{
+		if (generation.load(std::memory_order_acquire) != repeats_generation) {
+			// heap_reset by another thread, the pending tables are stale
+			pending_tables.clear();
+			pending = false;
+			return;
+		}
+
+		auto next = next_snapshot();
+		auto expected = snapshot;
+		// fails if heap_reset published an empty snapshot meanwhile
+		if (std::atomic_compare_exchange_strong(&published, &expected, next))
+			snapshot = next;
+		else
+			snapshot = expected;
+	}
+
+	PSIStore<_Alloc>									heap; // storage
+	std::map<uint_fast16_t, open_section>				open_sections; // PID -> data
 	mutable std::shared_mutex							mutex;
+	psi_crc_policy_t									crc_policy = psi_crc_reject;
+	std::map<uint_fast16_t, std::vector<section_filter>>	filters; // PID -> filters
+
+	size_t												budget = 0;
+	std::array<std::chrono::seconds, 256>				retention{}; // table_id -> max_age
+	bool												retention_set = false;
+	bool												expire_events = false;
+	bool												index_descriptors = false;
+	std::chrono::steady_clock::time_point				now;
+	std::chrono::steady_clock::time_point				last_prune;
+	time_t												stream_time = 0; // TDT/TOT
+	std::atomic<size_t>									memory_bytes{ 0 };
+
+	std::unordered_map<uint_fast32_t, repeat_entry>		repeats; // store key -> state
+	uint_fast32_t										repeats_generation = 0;
+	std::atomic<uint_fast32_t>							generation{ 0 }; // incremented by heap_reset
+
+	std::unordered_map<uint_fast32_t, table_state>		table_states; // table_key -> state
+
+	bool												snapshots = false;
+	std::shared_ptr<const PSISnapshot<_Alloc>>			snapshot; // last published, owned by the processing thread
+	std::shared_ptr<const PSISnapshot<_Alloc>>			published; // atomic access only
+	std::map<uint_fast32_t, std::shared_ptr<snapshot_table>>	pending_tables; // table_key -> copies not yet published
+	bool												pending = false;
 
 	std::function< void(const section_identifier&) >	transfer_callback;
+	std::function< void(const table_identifier&) >		table_callback;
+	std::function< void(const section_identifier&, const loop_delta&) >	delta_callback;
+
+	bool												batch = false;
+	std::vector<staged_section>							staged; // completed, not yet committed
+	std::deque<subscription>							subscriptions; // stable references
+	std::array<std::vector<size_t>, 256>				subscribers; // table_id -> subscriptions
 
 };
 
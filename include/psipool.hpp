@@ -0,0 +1,316 @@
+/*++
+*    tssi - A library for parsing MPEG-2 and DVB Transport Streams
+*
+*    Copyright (C) 2017 Martin Hoernig (goforcode.com)
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+--*/
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <unordered_map>
+#include "psiheap.hpp"
+
+namespace tssi
+{
+
+/****t* tssi/pool_identifier
+*  NAME
+*    pool_identifier -- Identifier for PSI sections of several transport streams.
+*    They define:
+*    - original_network_id
+*    - transport_stream_id
+*    - table_id
+*    - table_id_extension
+*    - section_number
+*  NOTES
+*    Service description and event information sections are identified by the
+*    transport stream they describe, so sections of other transport streams received
+*    on several multiplexes are stored once. Network information and bouquet
+*    association sections have original_network_id and transport_stream_id set to 0.
+*    All other sections belong to the multiplex they were received on.
+*  SOURCE
+*/
+using pool_identifier =
+std::tuple<uint_fast16_t, uint_fast16_t, uint_fast8_t, uint_fast16_t, uint_fast8_t>;
+/*******/
+
+
+/****c* tssi/PSIPool
+*  NAME
+*    PSIPool -- Stores PSI sections of several transport streams, written by several
+*    threads at once. Identical sections are stored once.
+*  NOTES
+*    Sections are distributed over independently locked shards. The latest version
+*    of a section is kept, version_numbers are compared modulo 32. Connect a PSIHeap per multiplex, e.g.
+*      pool.pool_connect(heap, original_network_id, transport_stream_id);
+*  METHODS
+*    pool_connect
+*    pool_insert
+*    pool_find
+*    pool_visit
+*    pool_size
+*    pool_reset
+*****/
+template <class _Alloc = std::allocator< char > >
+class PSIPool {
+public:
+	using section_ptr = std::shared_ptr<const PSISection<_Alloc>>;
+
+	PSIPool() = default;
+	PSIPool(const PSIPool<_Alloc>&) = delete;
+	PSIPool<_Alloc>& operator=(const PSIPool<_Alloc>&) = delete;
+
+	/****m* PSIPool/pool_connect
+	*  NAME
+	*    pool_connect -- Inserts every section stored by heap, received on the multiplex
+	*    original_network_id/transport_stream_id. The pool must outlive the heap.
+	*  SYNOPSIS
+	*/
+	void pool_connect(PSIHeap<_Alloc>& heap, uint_fast16_t original_network_id, uint_fast16_t transport_stream_id)
+	/*******/
+	{
+		heap.psi_callback(0x00, 0xff, [this, &heap, original_network_id, transport_stream_id](const section_identifier& si) {
+			pool_insert(original_network_id, transport_stream_id, heap.psi_heap().at(si).psi_data());
+		});
+	}
+
+	/****m* PSIPool/pool_insert
+	*  NAME
+	*    pool_insert -- Inserts a section received on the multiplex
+	*    original_network_id/transport_stream_id. Returns true if the section was new
+	*    or changed. A section older than the stored one, e.g. received late on
+	*    another multiplex, is ignored. Thread-safe.
+	*  SYNOPSIS
+	*/
+	bool pool_insert(uint_fast16_t original_network_id, uint_fast16_t transport_stream_id, gsl::span<const char> section)
+	/*******/
+	{
+		Expects(section.size() >= 3);
+
+		const auto key = pool_key(original_network_id, transport_stream_id, section);
+		const auto crc = section.size() >= 12 ? tail32(section) : crc32_mpeg2(section);
+		const auto packed = pack(key);
+		auto& shard = shards[shard_of(packed)];
+
+		{
+			std::shared_lock<std::shared_mutex> lock(shard.mutex);
+			auto stored = shard.sections.find(packed);
+			if (stored != shard.sections.end() &&
+				(equal(*stored->second, section) || newer(*stored->second, section)))
+				return false; // unchanged or outdated
+		}
+
+		auto shared = intern(section, crc, key);
+
+		std::unique_lock<std::shared_mutex> lock(shard.mutex);
+		auto& stored = shard.sections[packed];
+		if (stored == shared || (stored && newer(*stored, section)))
+			return false;
+		if (!stored)
+			count.fetch_add(1, std::memory_order_relaxed);
+		stored = std::move(shared);
+		return true;
+	}
+
+	/****m* PSIPool/pool_find
+	*  NAME
+	*    pool_find -- Returns the section with the identifier key or an empty pointer.
+	*    The section stays valid as long as the pointer is held. Thread-safe.
+	*  SYNOPSIS
+	*/
+	section_ptr pool_find(const pool_identifier& key) const
+	/*******/
+	{
+		const auto packed = pack(key);
+		const auto& shard = shards[shard_of(packed)];
+		std::shared_lock<std::shared_mutex> lock(shard.mutex);
+		auto stored = shard.sections.find(packed);
+		return stored == shard.sections.end() ? section_ptr() : stored->second;
+	}
+
+	/****m* PSIPool/pool_visit
+	*  NAME
+	*    pool_visit -- Calls function(const pool_identifier&, const PSISection<_Alloc>&)
+	*    for every section, in no particular order. Shards are locked one after
+	*    another for shared access, do not insert from function. Thread-safe.
+	*  SYNOPSIS
+	*/
+	template <class F>
+	void pool_visit(F&& function) const
+	/*******/
+	{
+		for (const auto& shard : shards) {
+			std::shared_lock<std::shared_mutex> lock(shard.mutex);
+			for (const auto& stored : shard.sections)
+				function(unpack(stored.first), *stored.second);
+		}
+	}
+
+	/****m* PSIPool/pool_size
+	*  NAME
+	*    pool_size -- Returns the number of sections. Thread-safe.
+	*  SYNOPSIS
+	*/
+	size_t pool_size() const noexcept
+	/*******/
+	{ return count.load(std::memory_order_relaxed); }
+
+	/****m* PSIPool/pool_reset
+	*  NAME
+	*    pool_reset -- Deletes all sections. Thread-safe.
+	*  SYNOPSIS
+	*/
+	void pool_reset()
+	/*******/
+	{
+		for (auto& shard : shards) {
+			std::unique_lock<std::shared_mutex> lock(shard.mutex);
+			count.fetch_sub(shard.sections.size(), std::memory_order_relaxed);
+			shard.sections.clear();
+		}
+		for (auto& shard : blobs) {
+			std::lock_guard<std::mutex> lock(shard.mutex);
+			shard.sections.clear();
+		}
+	}
+
+private:
+	static constexpr size_t shard_count = 16;
+	static constexpr size_t sweep_interval = 1024;
+
+	struct section_shard {
+		mutable std::shared_mutex							mutex;
+		std::unordered_map<uint_fast64_t, section_ptr>		sections; // packed pool_identifier
+	};
+
+	// deduplication of section data by CRC
+	struct blob_shard {
+		std::mutex														mutex;
+		std::unordered_multimap<uint_fast32_t, std::weak_ptr<const PSISection<_Alloc>>>	sections;
+		size_t															inserts = 0;
+	};
+
+	static pool_identifier pool_key(uint_fast16_t original_network_id, uint_fast16_t transport_stream_id, gsl::span<const char> section)
+	{
+		using namespace iso138181::private_section_syntax;
+
+		const auto table_id_ = table_id(section);
+		const bool syntax = section.size() >= 8 && section_syntax_indicator(section);
+		const auto extension = static_cast<uint_fast16_t>(syntax ? table_id_extension(section) : 0);
+		const auto number = static_cast<uint_fast8_t>(syntax ? section_number(section) : 0);
+
+		if ((table_id_ == 0x42 || table_id_ == 0x46) && section.size() >= 10) {
+			// service description: transport_stream_id, original_network_id
+			original_network_id = etsi300468::service_description_section::original_network_id(section);
+			transport_stream_id = extension;
+		}
+		else if (table_id_ >= 0x4e && table_id_ <= 0x6f && section.size() >= 12) {
+			// event information: transport_stream_id, original_network_id
+			original_network_id = etsi300468::event_information_section::original_network_id(section);
+			transport_stream_id = etsi300468::event_information_section::transport_stream_id(section);
+		}
+		else if (table_id_ == 0x40 || table_id_ == 0x41 || table_id_ == 0x4a) {
+			// network and bouquet
+			original_network_id = 0;
+			transport_stream_id = 0;
+		}
+
+		return std::make_tuple(original_network_id, transport_stream_id, table_id_, extension, number);
+	}
+
+	static uint_fast64_t pack(const pool_identifier& key) noexcept
+	{
+		return (static_cast<uint_fast64_t>(std::get<0>(key)) << 48) | (static_cast<uint_fast64_t>(std::get<1>(key)) << 32) |
+			(static_cast<uint_fast64_t>(std::get<2>(key)) << 24) | (static_cast<uint_fast64_t>(std::get<3>(key)) << 8) |
+			std::get<4>(key);
+	}
+
+	static pool_identifier unpack(uint_fast64_t key) noexcept
+	{
+		return std::make_tuple(static_cast<uint_fast16_t>(key >> 48), static_cast<uint_fast16_t>((key >> 32) & 0xffff),
+			static_cast<uint_fast8_t>((key >> 24) & 0xff), static_cast<uint_fast16_t>((key >> 8) & 0xffff),
+			static_cast<uint_fast8_t>(key & 0xff));
+	}
+
+	static size_t shard_of(uint_fast64_t key) noexcept
+	{ return static_cast<size_t>((key * 0x9e3779b97f4a7c15) >> 60) % shard_count; }
+
+	static uint_fast32_t tail32(gsl::span<const char> section) noexcept
+	{
+		const auto tail = section.last(4);
+		return (static_cast<uint_fast32_t>(static_cast<unsigned char>(tail[0])) << 24) |
+			(static_cast<uint_fast32_t>(static_cast<unsigned char>(tail[1])) << 16) |
+			(static_cast<uint_fast32_t>(static_cast<unsigned char>(tail[2])) << 8) |
+			static_cast<uint_fast32_t>(static_cast<unsigned char>(tail[3]));
+	}
+
+	static bool equal(const PSISection<_Alloc>& stored, gsl::span<const char> section) noexcept
+	{
+		const auto data = stored.psi_data();
+		return data.size() == section.size() && std::equal(data.cbegin(), data.cend(), section.cbegin());
+	}
+
+	// true if stored carries a later version_number than section, modulo 32
+	static bool newer(const PSISection<_Alloc>& stored, gsl::span<const char> section) noexcept
+	{
+		using namespace iso138181::private_section_syntax;
+
+		const auto data = stored.psi_data();
+		if (data.size() < 8 || section.size() < 8 ||
+			!section_syntax_indicator(data) || !section_syntax_indicator(section))
+			return false;
+		const auto distance = (version_number(data) - version_number(section)) & 0x1f;
+		return distance > 0 && distance < 16;
+	}
+
+	// returns the stored copy of identical data or a new one
+	section_ptr intern(gsl::span<const char> section, uint_fast32_t crc, const pool_identifier& key)
+	{
+		auto& shard = blobs[crc % shard_count];
+		std::lock_guard<std::mutex> lock(shard.mutex);
+
+		if (++shard.inserts % sweep_interval == 0) {
+			// drop data no longer referenced
+			for (auto it = shard.sections.begin(); it != shard.sections.end(); )
+				it = it->second.expired() ? shard.sections.erase(it) : std::next(it);
+		}
+
+		auto range = shard.sections.equal_range(crc);
+		for (auto it = range.first; it != range.second; ++it) {
+			auto existing = it->second.lock();
+			if (existing && equal(*existing, section))
+				return existing;
+		}
+
+		auto copy = std::make_shared<PSISection<_Alloc>>();
+		copy->section_data.assign(section.cbegin(), section.cend());
+		copy->view = copy->section_data;
+		copy->section_length = section.size();
+		copy->heap_key = std::make_tuple(std::get<2>(key), std::get<3>(key), std::get<4>(key));
+		copy->crc_valid = section.size() >= 12 && crc32_mpeg2(section) == 0;
+		shard.sections.emplace(crc, copy);
+		return copy;
+	}
+
+	std::array<section_shard, shard_count>		shards;
+	std::array<blob_shard, shard_count>			blobs;
+	std::atomic<size_t>							count{ 0 };
+};
+
+}
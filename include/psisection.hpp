@@ -0,0 +1,168 @@
+/*++
+*    tssi - A library for parsing MPEG-2 and DVB Transport Streams
+*
+*    Copyright (C) 2017 Martin Hoernig (goforcode.com)
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+--*/
+
+#pragma once
+
+#include <cstdint>
+#include <tuple>
+#include <vector>
+#include <memory>
+#include "specifications.hpp"
+#include "descriptorindex.hpp"
+
+namespace tssi
+{
+
+template <class _Alloc>
+class PSIHeap;
+
+template <class _Alloc>
+class PSIStore;
+
+template <class _Alloc>
+class PSISnapshot;
+
+template <class _Alloc>
+class PSIPool;
+
+/****t* tssi/section_identifier
+*  NAME
+*    section_identifier -- Identifier for PSI sections. They define: 
+*    - table_id
+*    - table_id_extension
+*    - section_number
+*  NOTES
+*    Sections with section_syntax_indicator == 0x0 have both table_id_extension and 
+*    section_number set to 0.
+*  DATA SCOPE
+*    iso138181::private_section
+*    iso138181::private_section_syntax
+*  SOURCE
+*/
+using section_identifier =
+std::tuple<uint_fast8_t, uint_fast16_t, uint_fast8_t>; 
+/*******/
+
+/****t* tssi/table_identifier
+*  NAME
+*    table_identifier -- Identifier for PSI tables (sub_tables). They define:
+*    - table_id
+*    - table_id_extension
+*  NOTES
+*    Tables with section_syntax_indicator == 0x0 have table_id_extension set to 0.
+*  DATA SCOPE
+*    iso138181::private_section
+*    iso138181::private_section_syntax
+*  SOURCE
+*/
+using table_identifier =
+std::tuple<uint_fast8_t, uint_fast16_t>;
+/*******/
+
+
+/****c* tssi/PSISection
+*  NAME
+*    PSISection -- Storage unit for a PSI section. Used by PSIHeap.
+*  NOTES
+*    Stored sections refer to their bytes in PSIStore, snapshot and pool copies own
+*    them.
+*  DATA SCOPE
+*    iso138181::private_section
+*    iso138181::private_section_syntax
+*  METHODS
+*    psi_data
+*    sizechars
+*    section_key
+*    crc32
+*    descriptor_index
+*****/
+template <class _Alloc = std::allocator< char > >
+class PSISection {
+public:
+	/****m* PSISection/psi_data
+	*  NAME
+	*    psi_data -- Retrieve a span to the data buffer of the section.
+	*  DATA SCOPE
+	*    iso138181::private_section
+	*    iso138181::private_section_syntax
+	*  SYNOPSIS
+	*/
+	gsl::span<const char> psi_data() const noexcept
+	/*******/
+	{ return view; }
+
+	/****m* PSISection/sizechars
+	*  NAME
+	*    sizechars -- Returns the size of the section (in bytes). This is not
+	*    section_length!
+	*  SYNOPSIS
+	*/
+	ptrdiff_t sizechars() const noexcept
+	/*******/
+	{ return section_length; }
+
+	/****m* PSISection/section_key
+	*  NAME
+	*    section_key -- Returns the identifier of the section.
+	*  SYNOPSIS
+	*/
+	section_identifier section_key() const noexcept
+	/*******/
+	{ return heap_key; }
+
+	/****m* PSISection/crc32
+	*  NAME
+	*    crc32 -- Check the section for validity. The CRC is verified once when the
+	*    section is completed. NB: Not all sections make use of the CRC32 mechanism.
+	*  SYNOPSIS
+	*/
+	bool crc32() const noexcept
+	/*******/
+	{ return crc_valid; }
+
+	/****m* PSISection/descriptor_index
+	*  NAME
+	*    descriptor_index -- Returns the index of the descriptor loops of the section,
+	*    or nullptr if the section has not been indexed (see PSIHeap/heap_descriptor_index).
+	*    e.g.
+	*      auto index = section.descriptor_index();
+	*      if (index && index->index_has(event, 0x4d))
+	*          auto d = index->index_find(section.psi_data(), event, 0x4d);
+	*  SYNOPSIS
+	*/
+	const DescriptorIndex* descriptor_index() const noexcept
+	/*******/
+	{ return descriptors.get(); }
+
+private:
+	friend class PSIHeap<_Alloc>;
+	friend class PSIStore<_Alloc>;
+	friend class PSISnapshot<_Alloc>;
+	friend class PSIPool<_Alloc>;
+
+	std::vector<char, _Alloc>	section_data; // snapshot and pool copies only
+	gsl::span<const char>	view; // see PSIStore
+	ptrdiff_t				section_length = 0; // total section length, != iso spec value
+	section_identifier		heap_key;
+	bool					crc_valid = false;
+	std::shared_ptr<const DescriptorIndex>	descriptors; // shared by all copies
+};
+
+}
@@ -0,0 +1,240 @@
+/*++
+*    tssi - A library for parsing MPEG-2 and DVB Transport Streams
+*
+*    Copyright (C) 2017 Martin Hoernig (goforcode.com)
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+--*/
+
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <iterator>
+#include <stdexcept>
+#include "psisection.hpp"
+
+namespace tssi
+{
+
+/****c* tssi/PSISnapshot
+*  NAME
+*    PSISnapshot -- Immutable view of all PSI sections cached by PSIHeap at one point
+*    in time. Iteration yields the sections in order of their section_identifier.
+*  NOTES
+*    Snapshots are published by PSIHeap if enabled with heap_snapshots. Readers need
+*    no lock and may keep a snapshot, or single sections of it, as long as they like.
+*    Sections are grouped by table (table_id, table_id_extension). Unchanged tables
+*    are shared between subsequent snapshots, so publishing a changed section copies
+*    its table and the table lists on the way to it only.
+*  METHODS
+*    begin
+*    end
+*    size
+*    empty
+*    find
+*    count
+*    at
+*    table
+*****/
+template <class _Alloc = std::allocator< char > >
+class PSISnapshot {
+public:
+	using section_ptr = std::shared_ptr<const PSISection<_Alloc>>;
+	using table_type = std::vector<section_ptr>;
+
+	class const_iterator {
+	public:
+		using iterator_category = std::forward_iterator_tag;
+		using value_type = PSISection<_Alloc>;
+		using difference_type = std::ptrdiff_t;
+		using pointer = const value_type*;
+		using reference = const value_type&;
+
+		const_iterator() = default;
+
+		reference operator*() const { return *sections()[position]; }
+		pointer operator->() const { return sections()[position].get(); }
+		const_iterator& operator++() { ++position; skip(); return *this; }
+		const_iterator operator++(int) { auto it = *this; ++*this; return it; }
+		bool operator==(const const_iterator& other) const
+		{ return table_id == other.table_id && table == other.table && position == other.position; }
+		bool operator!=(const const_iterator& other) const { return !(*this == other); }
+
+	private:
+		friend class PSISnapshot<_Alloc>;
+
+		const_iterator(const PSISnapshot<_Alloc>* snapshot_, size_t table_id_)
+			: snapshot(snapshot_), table_id(table_id_) { skip(); }
+
+		const table_type& sections() const
+		{ return *(*snapshot->tables[table_id].tables)[table].sections; }
+
+		// moves to the next existing section
+		void skip() noexcept
+		{
+			while (table_id < snapshot->tables.size()) {
+				const auto& tables = *snapshot->tables[table_id].tables;
+				while (table < tables.size() && position >= tables[table].sections->size()) {
+					++table;
+					position = 0;
+				}
+				if (table < tables.size())
+					return;
+				++table_id;
+				table = 0;
+			}
+		}
+
+		const PSISnapshot<_Alloc>*	snapshot = nullptr;
+		size_t						table_id = 0; // index into tables
+		size_t						table = 0;
+		size_t						position = 0;
+	};
+	using iterator = const_iterator;
+
+	/****m* PSISnapshot/begin
+	*  NAME
+	*    begin -- Returns an iterator to the section with the lowest section_identifier.
+	*  SYNOPSIS
+	*/
+	const_iterator begin() const noexcept
+	/*******/
+	{ return const_iterator(this, 0); }
+
+	/****m* PSISnapshot/end
+	*  NAME
+	*    end -- Returns the past-the-end iterator.
+	*  SYNOPSIS
+	*/
+	const_iterator end() const noexcept
+	/*******/
+	{ return const_iterator(this, tables.size()); }
+
+	/****m* PSISnapshot/size
+	*  NAME
+	*    size -- Returns the number of sections.
+	*  SYNOPSIS
+	*/
+	size_t size() const noexcept
+	/*******/
+	{ return section_count; }
+
+	/****m* PSISnapshot/empty
+	*  NAME
+	*    empty -- Returns true if the snapshot contains no section.
+	*  SYNOPSIS
+	*/
+	bool empty() const noexcept
+	/*******/
+	{ return section_count == 0; }
+
+	/****m* PSISnapshot/find
+	*  NAME
+	*    find -- Returns the section with the identifier key or an empty pointer.
+	*  SYNOPSIS
+	*/
+	section_ptr find(const section_identifier& key) const
+	/*******/
+	{
+		const auto sections = lookup(table_identifier(std::get<0>(key), std::get<1>(key)));
+		if (!sections)
+			return section_ptr();
+		auto it = std::lower_bound(sections->cbegin(), sections->cend(), key, key_less);
+		if (it == sections->cend() || (*it)->section_key() != key)
+			return section_ptr();
+		return *it;
+	}
+
+	/****m* PSISnapshot/count
+	*  NAME
+	*    count -- Returns 1 if a section with the identifier key exists, 0 otherwise.
+	*  SYNOPSIS
+	*/
+	size_t count(const section_identifier& key) const
+	/*******/
+	{ return find(key) ? 1 : 0; }
+
+	/****m* PSISnapshot/at
+	*  NAME
+	*    at -- Returns the section with the identifier key. Throws std::out_of_range if
+	*    there is none.
+	*  SYNOPSIS
+	*/
+	const PSISection<_Alloc>& at(const section_identifier& key) const
+	/*******/
+	{
+		const auto section = find(key);
+		if (!section)
+			throw std::out_of_range("PSISnapshot::at");
+		return *section;
+	}
+
+	/****m* PSISnapshot/table
+	*  NAME
+	*    table -- Returns all sections of the given table (table_id,
+	*    table_id_extension), ordered by section_number.
+	*  SYNOPSIS
+	*/
+	const table_type& table(const table_identifier& table) const
+	/*******/
+	{
+		static const table_type none;
+		const auto sections = lookup(table);
+		return sections ? *sections : none;
+	}
+
+private:
+	friend class PSIHeap<_Alloc>;
+
+	// sections of a table, not empty
+	struct table_entry {
+		uint_fast16_t						table_id_extension;
+		std::shared_ptr<const table_type>	sections;
+	};
+	using table_list = std::vector<table_entry>; // ordered by table_id_extension
+
+	// tables with a table_id, not empty
+	struct table_id_entry {
+		uint_fast8_t						table_id;
+		std::shared_ptr<const table_list>	tables;
+	};
+
+	static bool key_less(const section_ptr& section, const section_identifier& key) noexcept
+	{ return section->section_key() < key; }
+
+	static bool table_id_less(const table_id_entry& entry, uint_fast8_t table_id) noexcept
+	{ return entry.table_id < table_id; }
+
+	static bool extension_less(const table_entry& entry, uint_fast16_t table_id_extension) noexcept
+	{ return entry.table_id_extension < table_id_extension; }
+
+	const table_type* lookup(const table_identifier& table) const noexcept
+	{
+		auto id = std::lower_bound(tables.cbegin(), tables.cend(), std::get<0>(table), table_id_less);
+		if (id == tables.cend() || id->table_id != std::get<0>(table))
+			return nullptr;
+		auto entry = std::lower_bound(id->tables->cbegin(), id->tables->cend(), std::get<1>(table), extension_less);
+		if (entry == id->tables->cend() || entry->table_id_extension != std::get<1>(table))
+			return nullptr;
+		return entry->sections.get();
+	}
+
+	std::vector<table_id_entry>		tables; // ordered by table_id
+	size_t							section_count = 0;
+};
+
+}
@@ -0,0 +1,549 @@
+/*++
+*    tssi - A library for parsing MPEG-2 and DVB Transport Streams
+*
+*    Copyright (C) 2017 Martin Hoernig (goforcode.com)
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+--*/
+
+#pragma once
+
+#include <vector>
+#include <map>
+#include <memory>
+#include <algorithm>
+#include <iterator>
+#include <stdexcept>
+#include "psisection.hpp"
+#include "mappedfile.hpp"
+
+namespace tssi
+{
+
+/****c* tssi/PSIStore
+*  NAME
+*    PSIStore -- Cache of PSI sections used by PSIHeap. Sections are found by an
+*    open-addressing hash table and iterated in order of their section_identifier by
+*    a sorted index. The section data of all sections is kept in contiguous chunks.
+*    Range queries by table_id and by table_identifier use the sorted index, event
+*    information sections are indexed by service_id as well.
+*  NOTES
+*    The interface is a read-only subset of std::map<section_identifier,
+*    PSISection<_Alloc>>. Iterators and references are invalidated when PSIHeap
+*    stores new sections, see PSIHeap/lock_shared. Sections loaded by
+*    PSIHeap/heap_load are served from the mapped file until they are replaced.
+*    New sections are sorted into the index once per commit, so filling the store
+*    in batch mode (PSIHeap/heap_batch) costs one merge per batch rather than one
+*    sorted insert per section.
+*  METHODS
+*    begin
+*    end
+*    size
+*    empty
+*    find
+*    count
+*    at
+*    table_range
+*    service_range
+*****/
+template <class _Alloc = std::allocator< char > >
+class PSIStore {
+	static constexpr uint_fast32_t no_index = 0xffffffff;
+
+	struct slot {
+		uint_fast32_t key = 0;
+		uint_fast32_t index = no_index;
+	};
+
+public:
+	using key_type = section_identifier;
+	using mapped_type = PSISection<_Alloc>;
+	using value_type = std::pair<section_identifier, PSISection<_Alloc>>;
+	using size_type = size_t;
+
+	class const_range;
+
+	class const_iterator {
+	public:
+		using iterator_category = std::bidirectional_iterator_tag;
+		using value_type = typename PSIStore<_Alloc>::value_type;
+		using difference_type = std::ptrdiff_t;
+		using pointer = const value_type*;
+		using reference = const value_type&;
+
+		const_iterator() = default;
+
+		reference operator*() const { return (*entries)[position->index]; }
+		pointer operator->() const { return &(*entries)[position->index]; }
+		const_iterator& operator++() { ++position; return *this; }
+		const_iterator operator++(int) { auto it = *this; ++position; return it; }
+		const_iterator& operator--() { --position; return *this; }
+		const_iterator operator--(int) { auto it = *this; --position; return it; }
+		bool operator==(const const_iterator& other) const { return position == other.position; }
+		bool operator!=(const const_iterator& other) const { return position != other.position; }
+
+	private:
+		friend class PSIStore<_Alloc>;
+		friend class const_range;
+
+		const_iterator(const std::vector<value_type>* entries_, typename std::vector<slot>::const_iterator position_)
+			: entries(entries_), position(position_) {}
+
+		const std::vector<value_type>*				entries = nullptr;
+		typename std::vector<slot>::const_iterator	position;
+	};
+	using iterator = const_iterator;
+
+	// sections returned by table_range and service_range
+	class const_range {
+	public:
+		const_iterator begin() const noexcept { return first; }
+		const_iterator end() const noexcept { return last; }
+		bool empty() const noexcept { return first == last; }
+		size_type size() const noexcept { return static_cast<size_type>(std::distance(first.position, last.position)); }
+
+	private:
+		friend class PSIStore<_Alloc>;
+
+		const_range(const_iterator first_, const_iterator last_) : first(first_), last(last_) {}
+
+		const_iterator	first;
+		const_iterator	last;
+	};
+
+	PSIStore() = default;
+
+	PSIStore(const PSIStore<_Alloc>& other) { *this = other; }
+
+	PSIStore<_Alloc>& operator=(const PSIStore<_Alloc>& other)
+	{
+		if (this != &other) {
+			clear();
+			for (const auto& entry : other.entries)
+				assign(entry.second, entry.second.psi_data());
+			merge();
+		}
+		return *this;
+	}
+
+	/****m* PSIStore/begin
+	*  NAME
+	*    begin -- Returns an iterator to the section with the lowest section_identifier.
+	*  SYNOPSIS
+	*/
+	const_iterator begin() const noexcept
+	/*******/
+	{ return const_iterator(&entries, order.cbegin()); }
+
+	/****m* PSIStore/end
+	*  NAME
+	*    end -- Returns the past-the-end iterator.
+	*  SYNOPSIS
+	*/
+	const_iterator end() const noexcept
+	/*******/
+	{ return const_iterator(&entries, order.cend()); }
+
+	const_iterator cbegin() const noexcept { return begin(); }
+	const_iterator cend() const noexcept { return end(); }
+
+	/****m* PSIStore/size
+	*  NAME
+	*    size -- Returns the number of sections.
+	*  SYNOPSIS
+	*/
+	size_type size() const noexcept
+	/*******/
+	{ return entries.size(); }
+
+	/****m* PSIStore/empty
+	*  NAME
+	*    empty -- Returns true if no section is stored.
+	*  SYNOPSIS
+	*/
+	bool empty() const noexcept
+	/*******/
+	{ return entries.empty(); }
+
+	/****m* PSIStore/find
+	*  NAME
+	*    find -- Returns an iterator to the section with the identifier key or end().
+	*  SYNOPSIS
+	*/
+	const_iterator find(const section_identifier& key) const
+	/*******/
+	{
+		const auto packed = store_key(key);
+		if (lookup(packed) == no_index)
+			return end();
+		return const_iterator(&entries, std::lower_bound(order.cbegin(), order.cend(), packed, key_less));
+	}
+
+	/****m* PSIStore/count
+	*  NAME
+	*    count -- Returns 1 if a section with the identifier key is stored, 0 otherwise.
+	*  SYNOPSIS
+	*/
+	size_type count(const section_identifier& key) const noexcept
+	/*******/
+	{ return lookup(store_key(key)) == no_index ? 0 : 1; }
+
+	/****m* PSIStore/at
+	*  NAME
+	*    at -- Returns the section with the identifier key. Throws std::out_of_range if
+	*    there is none.
+	*  SYNOPSIS
+	*/
+	const PSISection<_Alloc>& at(const section_identifier& key) const
+	/*******/
+	{
+		const auto index = lookup(store_key(key));
+		if (index == no_index)
+			throw std::out_of_range("PSIStore::at");
+		return entries[index].second;
+	}
+
+	/****m* PSIStore/table_range
+	*  NAME
+	*    table_range -- Returns the sections with a table_id from table_id_first to
+	*    table_id_last, or the sections of table, in order of their section_identifier.
+	*    Only the sections returned are visited.
+	*  SYNOPSIS
+	*/
+	const_range table_range(uint_fast8_t table_id_first, uint_fast8_t table_id_last) const
+	/*******/
+	{
+		Expects(table_id_first <= table_id_last);
+		const auto first = static_cast<uint_fast32_t>(table_id_first) << 24;
+		const auto last = (static_cast<uint_fast32_t>(table_id_last) << 24) | 0xffffff;
+		return range(order, first, last);
+	}
+
+	const_range table_range(const table_identifier& table) const
+	{
+		const auto first = store_key(std::make_tuple(std::get<0>(table), std::get<1>(table), static_cast<uint_fast8_t>(0)));
+		return range(order, first, first | 0xff);
+	}
+
+	/****m* PSIStore/service_range
+	*  NAME
+	*    service_range -- Returns the event information sections (table_id 0x4e to
+	*    0x6f) of the service service_id, in order of table_id and section_number.
+	*    Only the sections returned are visited.
+	*  SYNOPSIS
+	*/
+	const_range service_range(uint_fast16_t service_id) const
+	/*******/
+	{
+		const auto first = static_cast<uint_fast32_t>(service_id) << 16;
+		return range(service_order, first, first | 0xffff);
+	}
+
+private:
+	friend class PSIHeap<_Alloc>;
+
+	static constexpr size_t chunk_size = 0x10000;
+
+	static bool event_information(uint_fast32_t key) noexcept
+	{ return (key >> 24) >= 0x4e && (key >> 24) <= 0x6f; }
+
+	// service_id, table_id and section_number packed in order, event information only
+	static uint_fast32_t service_key(uint_fast32_t key) noexcept
+	{ return ((key & 0xffff00) << 8) | ((key >> 16) & 0xff00) | (key & 0xff); }
+
+	// sections of index with keys from first to last
+	const_range range(const std::vector<slot>& index, uint_fast32_t first, uint_fast32_t last) const
+	{
+		auto lower = std::lower_bound(index.cbegin(), index.cend(), first, key_less);
+		auto upper = std::upper_bound(lower, index.cend(), last, [](uint_fast32_t key, const slot& s) { return key < s.key; });
+		return const_range(const_iterator(&entries, lower), const_iterator(&entries, upper));
+	}
+
+	// table_id, table_id_extension and section_number packed in order
+	static uint_fast32_t store_key(const section_identifier& key) noexcept
+	{
+		return (static_cast<uint_fast32_t>(std::get<0>(key)) << 24) |
+			(static_cast<uint_fast32_t>(std::get<1>(key)) << 8) | std::get<2>(key);
+	}
+
+	static bool key_less(const slot& s, uint_fast32_t key) noexcept
+	{ return s.key < key; }
+
+	size_t hash_position(uint_fast32_t key) const noexcept
+	{ return static_cast<size_t>(((key * 0x9e3779b1) & 0xffffffff) >> hash_shift); }
+
+	uint_fast32_t lookup(uint_fast32_t key) const noexcept
+	{
+		if (table.empty())
+			return no_index;
+		const size_t mask = table.size() - 1;
+		for (size_t i = hash_position(key); table[i].index != no_index; i = (i + 1) & mask) {
+			if (table[i].key == key)
+				return table[i].index;
+		}
+		return no_index;
+	}
+
+	void rehash(size_t capacity)
+	{
+		table.assign(capacity, slot());
+		hash_shift = 32;
+		for (size_t n = capacity; n > 1; n >>= 1)
+			--hash_shift;
+		const size_t mask = capacity - 1;
+		for (const auto& s : order) {
+			size_t i = hash_position(s.key);
+			while (table[i].index != no_index)
+				i = (i + 1) & mask;
+			table[i] = s;
+		}
+	}
+
+	// copies the bytes of data to the arena
+	gsl::span<const char> allocate(gsl::span<const char> data)
+	{
+		const auto n = static_cast<size_t>(data.size());
+		if (chunks.empty() || chunks.back().capacity() - chunks.back().size() < n) {
+			chunks.emplace_back();
+			chunks.back().reserve(n > chunk_size ? n : chunk_size);
+		}
+		auto& chunk = chunks.back();
+		const auto offset = chunk.size();
+		chunk.insert(chunk.end(), data.cbegin(), data.cend()); // within capacity, no reallocation
+		arena_bytes += n;
+		return gsl::span<const char>(chunk.data() + offset, data.size());
+	}
+
+	// index of the entry with the identifier section_key, created if necessary
+	uint_fast32_t insert(const section_identifier& section_key)
+	{
+		const auto key = store_key(section_key);
+		auto index = lookup(key);
+
+		if (index == no_index) {
+			index = static_cast<uint_fast32_t>(entries.size());
+			entries.emplace_back(section_key, PSISection<_Alloc>());
+			capacities.push_back(0);
+
+			slot s;
+			s.key = key;
+			s.index = index;
+			order.push_back(s); // sorted by merge()
+			if (event_information(key))
+				service_order.push_back({ service_key(key), index });
+			if (entries.size() * 2 > table.size())
+				rehash(std::max<size_t>(16, table.size() * 2));
+			else {
+				size_t i = hash_position(key);
+				while (table[i].index != no_index)
+					i = (i + 1) & (table.size() - 1);
+				table[i] = s;
+			}
+		}
+		return index;
+	}
+
+	// sorts the slots appended by insert() into the indices, once per batch of
+	// sections instead of once per section
+	void merge()
+	{
+		merge(order, order_sorted);
+		merge(service_order, service_sorted);
+	}
+
+	static void merge(std::vector<slot>& index, size_t& sorted)
+	{
+		if (sorted == index.size())
+			return;
+		const auto less = [](const slot& a, const slot& b) { return a.key < b.key; };
+		const auto middle = index.begin() + static_cast<std::ptrdiff_t>(sorted);
+		std::sort(middle, index.end(), less);
+		std::inplace_merge(index.begin(), middle, index.end(), less);
+		sorted = index.size();
+	}
+
+	// stores a copy of data, replacing a section with the same identifier
+	void assign(const PSISection<_Alloc>& section, gsl::span<const char> data)
+	{
+		const auto n = static_cast<size_t>(data.size());
+		const auto index = insert(section.heap_key);
+
+		auto& stored = entries[index].second;
+		release(index);
+		live_bytes += n;
+		if (n <= capacities[index]) {
+			// reuse the former location
+			std::copy(data.cbegin(), data.cend(), const_cast<char*>(stored.view.data()));
+			stored.view = gsl::span<const char>(stored.view.data(), data.size());
+		}
+		else {
+			stored.view = allocate(data);
+			capacities[index] = static_cast<uint_fast32_t>(n);
+		}
+		stored.section_length = section.section_length;
+		stored.heap_key = section.heap_key;
+		stored.crc_valid = section.crc_valid;
+		stored.descriptors = section.descriptors;
+
+		if (arena_bytes - live_bytes > (live_bytes > chunk_size ? live_bytes : chunk_size))
+			compact();
+	}
+
+	// stores a section located in mapping without copying
+	void assign_mapped(const section_identifier& section_key, gsl::span<const char> data, bool crc_valid)
+	{
+		const auto index = insert(section_key);
+		release(index);
+		capacities[index] = 0; // not in the arena
+		mapped_bytes += static_cast<size_t>(data.size());
+
+		auto& stored = entries[index].second;
+		stored.view = data;
+		stored.section_length = data.size();
+		stored.heap_key = section_key;
+		stored.crc_valid = crc_valid;
+		stored.descriptors.reset();
+	}
+
+	// accounts for the data of entry index being dropped
+	void release(uint_fast32_t index) noexcept
+	{
+		const auto n = static_cast<size_t>(entries[index].second.view.size());
+		if (capacities[index] > 0)
+			live_bytes -= n;
+		else if (n > 0) {
+			mapped_bytes -= n;
+			if (mapped_bytes == 0)
+				mapping.reset(); // no section left in the file
+		}
+	}
+
+	// removes the section with the identifier section_key
+	void erase(const section_identifier& section_key)
+	{
+		if (table.empty())
+			return;
+
+		const auto key = store_key(section_key);
+		const size_t mask = table.size() - 1;
+		size_t i = hash_position(key);
+		while (table[i].index != no_index && table[i].key != key)
+			i = (i + 1) & mask;
+		if (table[i].index == no_index)
+			return; // not stored
+		const auto index = table[i].index;
+
+		// backward shift deletion
+		size_t hole = i;
+		for (size_t j = (i + 1) & mask; table[j].index != no_index; j = (j + 1) & mask) {
+			if (((j - hash_position(table[j].key)) & mask) >= ((j - hole) & mask)) {
+				table[hole] = table[j];
+				hole = j;
+			}
+		}
+		table[hole] = slot();
+
+		merge();
+		order.erase(std::lower_bound(order.begin(), order.end(), key, key_less));
+		if (event_information(key))
+			service_order.erase(std::lower_bound(service_order.begin(), service_order.end(), service_key(key), key_less));
+		release(index);
+
+		// keep entries dense
+		const auto last = static_cast<uint_fast32_t>(entries.size() - 1);
+		if (index != last) {
+			entries[index] = std::move(entries[last]);
+			capacities[index] = capacities[last];
+
+			const auto moved = store_key(entries[index].first);
+			std::lower_bound(order.begin(), order.end(), moved, key_less)->index = index;
+			if (event_information(moved))
+				std::lower_bound(service_order.begin(), service_order.end(), service_key(moved), key_less)->index = index;
+			size_t k = hash_position(moved);
+			while (table[k].index == no_index || table[k].key != moved)
+				k = (k + 1) & mask;
+			table[k].index = index;
+		}
+		entries.pop_back();
+		capacities.pop_back();
+		order_sorted = order.size();
+		service_sorted = service_order.size();
+
+		if (arena_bytes - live_bytes > (live_bytes > chunk_size ? live_bytes : chunk_size))
+			compact();
+	}
+
+	// bytes of all sections
+	size_t section_bytes() const noexcept
+	{ return live_bytes + mapped_bytes; }
+
+	// bytes allocated
+	size_t memory() const noexcept
+	{
+		size_t bytes = entries.capacity() * sizeof(value_type) + capacities.capacity() * sizeof(uint_fast32_t) +
+			(order.capacity() + service_order.capacity() + table.capacity()) * sizeof(slot);
+		for (const auto& chunk : chunks)
+			bytes += chunk.capacity();
+		return bytes;
+	}
+
+	// moves all sections to new chunks, dropping unused space
+	void compact()
+	{
+		std::vector<std::vector<char, _Alloc>> old_chunks;
+		old_chunks.swap(chunks);
+		arena_bytes = 0;
+		for (size_t i = 0; i < entries.size(); ++i) {
+			auto& stored = entries[i].second;
+			stored.view = allocate(stored.view);
+			capacities[i] = static_cast<uint_fast32_t>(stored.view.size());
+		}
+		live_bytes += mapped_bytes;
+		mapped_bytes = 0;
+		mapping.reset();
+	}
+
+	void clear() noexcept
+	{
+		entries.clear();
+		capacities.clear();
+		order.clear();
+		service_order.clear();
+		order_sorted = 0;
+		service_sorted = 0;
+		table.clear();
+		chunks.clear();
+		live_bytes = 0;
+		arena_bytes = 0;
+		mapping.reset();
+		mapped_bytes = 0;
+	}
+
+	std::vector<value_type>						entries; // dense
+	std::vector<uint_fast32_t>					capacities; // arena bytes per entry
+	std::vector<slot>							order; // sorted by key
+	std::vector<slot>							service_order; // event information, sorted by service_key
+	size_t										order_sorted = 0; // slots of order sorted, see merge()
+	size_t										service_sorted = 0; // slots of service_order sorted
+	std::vector<slot>							table; // open addressing, linear probing
+	unsigned									hash_shift = 32;
+	std::vector<std::vector<char, _Alloc>>		chunks; // arena
+	size_t										live_bytes = 0;
+	size_t										arena_bytes = 0;
+	std::shared_ptr<const MappedFile>			mapping; // see PSIHeap/heap_load
+	size_t										mapped_bytes = 0;
+};
+
+}
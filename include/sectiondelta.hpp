@@ -0,0 +1,170 @@
+/*++
+*    tssi - A library for parsing MPEG-2 and DVB Transport Streams
+*
+*    Copyright (C) 2017 Martin Hoernig (goforcode.com)
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+--*/
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include "specifications.hpp"
+
+namespace tssi
+{
+
+/****t* tssi/psi_delta_t
+*  NAME
+*    psi_delta_t -- Kind of change of a loop entry between two versions of a
+*    section (see loop_delta).
+*  SOURCE
+*/
+enum psi_delta_t : uint_fast8_t {
+	psi_delta_added = 0x0,
+	psi_delta_removed = 0x1,
+	psi_delta_changed = 0x2
+};
+/*******/
+
+
+/****t* tssi/loop_delta
+*  NAME
+*    loop_delta -- Change of a loop entry between two versions of a section. Entries
+*    are identified by entry_id:
+*    - TS_program_map_section: elementary_PID
+*    - service_description_section: service_id
+*    - event_information_section: event_id
+*    old_entry is empty for added entries, new_entry for removed ones.
+*  NOTES
+*    The spans refer to the sections compared and are valid within the callback
+*    only. Decode them with the loop accessors, e.g.
+*    etsi300468::event_information_section::loop.
+*  SOURCE
+*/
+struct loop_delta {
+	psi_delta_t				delta;
+	uint_fast16_t			entry_id;
+	gsl::span<const char>	old_entry;
+	gsl::span<const char>	new_entry;
+};
+/*******/
+
+
+namespace {
+	// loop layout of sections supported by section_delta
+	struct loop_layout {
+		ptrdiff_t	start; // first entry
+		ptrdiff_t	fixed; // entry size without descriptors
+		ptrdiff_t	length; // offset of the 12 bit descriptors length in an entry
+		uint_fast16_t	id_mask; // of the first 16 bits of an entry
+		ptrdiff_t	id; // offset of the identifier in an entry
+	};
+
+	inline bool delta_layout(gsl::span<const char> section, loop_layout& layout) noexcept
+	{
+		if (section.size() < 3)
+			return false;
+		const auto table_id = static_cast<uint8_t>(section[0]);
+		if (table_id == 0x02 && section.size() >= 12) {
+			const auto program_info_length = (static_cast<ptrdiff_t>(static_cast<uint8_t>(section[10]) & 0x0f) << 8) |
+				static_cast<uint8_t>(section[11]);
+			layout = { 12 + program_info_length, 5, 3, 0x1fff, 1 };
+			return true;
+		}
+		if (table_id == 0x42 || table_id == 0x46) {
+			layout = { 11, 5, 3, 0xffff, 0 };
+			return true;
+		}
+		if (table_id >= 0x4e && table_id <= 0x6f) {
+			layout = { 14, 12, 10, 0xffff, 0 };
+			return true;
+		}
+		return false;
+	}
+
+	// appends the loop entries of section, stops at the first truncated entry
+	inline void delta_entries(gsl::span<const char> section, const loop_layout& layout,
+		std::vector<std::pair<uint_fast16_t, gsl::span<const char>>>& entries)
+	{
+		const ptrdiff_t end = section.size() - 4; // CRC_32
+		for (ptrdiff_t pos = layout.start; pos + layout.fixed <= end; ) {
+			const auto entry = section.subspan(pos);
+			const auto size = layout.fixed + ((static_cast<ptrdiff_t>(static_cast<uint8_t>(entry[layout.length]) & 0x0f) << 8) |
+				static_cast<uint8_t>(entry[layout.length + 1]));
+			if (pos + size > end)
+				break;
+			const auto id = static_cast<uint_fast16_t>(((static_cast<uint_fast16_t>(static_cast<uint8_t>(entry[layout.id])) << 8) |
+				static_cast<uint8_t>(entry[layout.id + 1])) & layout.id_mask);
+			entries.emplace_back(id, entry.first(size));
+			pos += size;
+		}
+		std::stable_sort(entries.begin(), entries.end(),
+			[](const auto& a, const auto& b) { return a.first < b.first; });
+	}
+}
+
+
+/****f* tssi/section_delta
+*  NAME
+*    section_delta -- Compares the loop entries of two versions of a section and
+*    calls function(const loop_delta&) for every added, removed or changed entry,
+*    in order of entry_id. Unchanged entries are skipped. If old_section is empty,
+*    all entries of new_section are added. Returns false if the table is not
+*    supported (see loop_delta).
+*  NOTES
+*    Both sections are expected to be of the same table. Entries beyond the
+*    section or its CRC_32 are ignored.
+*  SYNOPSIS
+*/
+template <class F>
+bool section_delta(gsl::span<const char> old_section, gsl::span<const char> new_section, F&& function)
+/*******/
+{
+	loop_layout new_layout, old_layout;
+	if (!delta_layout(new_section, new_layout))
+		return false;
+
+	std::vector<std::pair<uint_fast16_t, gsl::span<const char>>> old_entries, new_entries;
+	if (!old_section.empty() && delta_layout(old_section, old_layout))
+		delta_entries(old_section, old_layout, old_entries);
+	delta_entries(new_section, new_layout, new_entries);
+
+	auto o = old_entries.cbegin();
+	auto n = new_entries.cbegin();
+	while (o != old_entries.cend() || n != new_entries.cend()) {
+		if (n == new_entries.cend() || (o != old_entries.cend() && o->first < n->first)) {
+			function(loop_delta{ psi_delta_removed, o->first, o->second, gsl::span<const char>() });
+			++o;
+		}
+		else if (o == old_entries.cend() || n->first < o->first) {
+			function(loop_delta{ psi_delta_added, n->first, gsl::span<const char>(), n->second });
+			++n;
+		}
+		else {
+			if (o->second.size() != n->second.size() ||
+				!std::equal(o->second.cbegin(), o->second.cend(), n->second.cbegin()))
+				function(loop_delta{ psi_delta_changed, n->first, o->second, n->second });
+			++o;
+			++n;
+		}
+	}
+	return true;
+}
+
+}
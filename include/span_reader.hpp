@@ -23,15 +23,57 @@
 #include <gsl/span>
 #include <string>
 #include <chrono>
+#include <cstring>
+#include <cstdint>
+#include <vector>
+#include <iterator>
+#ifdef _MSC_VER
+#include <stdlib.h>
+#endif // _MSC_VER
+
+#if defined(__BYTE_ORDER__) && defined(__ORDER_BIG_ENDIAN__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define TSSI_BIG_ENDIAN
+#endif
 
 namespace tssi
 {
 
+/****c* tssi/validated_span
+*  NAME
+*    validated_span -- A gsl::span<const char> of at least fixed_size bytes, e.g. a
+*    section or a loop entry whose length fields have been checked. Fields within
+*    the first fixed_size bytes are read by a single unaligned load, without bounds
+*    checks. Fields beyond are read like from gsl::span<const char>.
+*    e.g.
+*       if (loop.size() >= 12) {
+*           validated_span<12> entry(loop);
+*           auto id = event_id(entry);
+*       }
+*  NOTES
+*    Construction with less than fixed_size bytes violates a precondition.
+*  SOURCE
+*/
+template <ptrdiff_t fixed_size>
+class validated_span {
+public:
+	explicit validated_span(gsl::span<const char> data) : data_(data)
+	{ Expects(data.size() >= fixed_size); }
+
+	operator gsl::span<const char>() const noexcept { return data_; }
+	const char* data() const noexcept { return data_.data(); }
+	ptrdiff_t size() const noexcept { return data_.size(); }
+
+private:
+	gsl::span<const char> data_;
+};
+/*******/
+
 template <size_t offset, size_t length>
 class basic_reader {
 public:
 	typedef char element_type;
 	static constexpr unsigned char error_value = 0x00;
+	static constexpr ptrdiff_t fixed_position = length == 0 ? static_cast<ptrdiff_t>(offset) : -1; // -1: depends on index
 
 	element_type operator()(gsl::span<const char> data, size_t index = 0, size_t offset2 = 0) const noexcept
 	{
@@ -40,11 +82,24 @@ public:
 
 	static element_type at(gsl::span<const char> data, size_t index = 0, size_t offset2 = 0) noexcept
 	{
-		const ptrdiff_t position = offset + index * length + offset2;		
-		if (position >= data.size())
+		const ptrdiff_t position_ = position(data, index, offset2);
+		if (position_ >= data.size())
 			return static_cast<element_type>(error_value);
 		else
-			return data[position];
+			return data[position_];
+	}
+
+	template <ptrdiff_t fixed_size>
+	static element_type at(validated_span<fixed_size> data, size_t index = 0, size_t offset2 = 0) noexcept
+	{
+		if (fixed_position >= 0 && fixed_position < fixed_size && offset2 == 0)
+			return data.data()[fixed_position];
+		return at(static_cast<gsl::span<const char>>(data), index, offset2);
+	}
+
+	static ptrdiff_t position(gsl::span<const char>, size_t index = 0, size_t offset2 = 0) noexcept
+	{
+		return offset + index * length + offset2;
 	}
 };
 
@@ -161,6 +216,111 @@ private:
 	Span span_;
 };
 
+/****c* tssi/indexed_span
+*  NAME
+*    indexed_span -- Random access to the elements of a loop. The element offsets are
+*    determined once by a forward walk (like range_span_iterator) and kept in a
+*    compact vector, so elements can be accessed by index, counted by size() and
+*    split across threads, e.g. by std::for_each with an execution policy:
+*       auto events = event_info_loop(section).indexed();
+*       std::for_each(std::execution::par, events.begin(), events.end(),
+*           [](gsl::span<const char> event) { ... });
+*  NOTES
+*    Elements are sliced to their stride, the last one is clipped to the end of the
+*    data. The index refers to the data, which must outlive it. Up to 0xffff bytes.
+*  SOURCE
+*/
+template<tssi_size_t iteration_stride>
+class indexed_span {
+	typedef gsl::span<const char> Span;
+
+public:
+	using value_type = Span;
+	using size_type = size_t;
+
+	class const_iterator {
+	public:
+		using iterator_category = std::random_access_iterator_tag;
+		using value_type = Span;
+		using difference_type = std::ptrdiff_t;
+		using pointer = void;
+		using reference = Span;
+
+		const_iterator() noexcept = default;
+		const_iterator(const indexed_span* container, difference_type index) noexcept : container_(container), index_(index) { }
+
+		reference operator*() const noexcept { return (*container_)[static_cast<size_t>(index_)]; }
+		reference operator[](difference_type n) const noexcept { return (*container_)[static_cast<size_t>(index_ + n)]; }
+
+		const_iterator& operator++() noexcept { ++index_; return *this; }
+		const_iterator operator++(int) noexcept { auto ret = *this; ++index_; return ret; }
+		const_iterator& operator--() noexcept { --index_; return *this; }
+		const_iterator operator--(int) noexcept { auto ret = *this; --index_; return ret; }
+		const_iterator& operator+=(difference_type n) noexcept { index_ += n; return *this; }
+		const_iterator& operator-=(difference_type n) noexcept { index_ -= n; return *this; }
+
+		friend const_iterator operator+(const_iterator it, difference_type n) noexcept { return it += n; }
+		friend const_iterator operator+(difference_type n, const_iterator it) noexcept { return it += n; }
+		friend const_iterator operator-(const_iterator it, difference_type n) noexcept { return it -= n; }
+		friend difference_type operator-(const const_iterator& lhs, const const_iterator& rhs) noexcept { return lhs.index_ - rhs.index_; }
+
+		friend bool operator==(const const_iterator& lhs, const const_iterator& rhs) noexcept { return lhs.index_ == rhs.index_; }
+		friend bool operator!=(const const_iterator& lhs, const const_iterator& rhs) noexcept { return lhs.index_ != rhs.index_; }
+		friend bool operator<(const const_iterator& lhs, const const_iterator& rhs) noexcept { return lhs.index_ < rhs.index_; }
+		friend bool operator>(const const_iterator& lhs, const const_iterator& rhs) noexcept { return lhs.index_ > rhs.index_; }
+		friend bool operator<=(const const_iterator& lhs, const const_iterator& rhs) noexcept { return lhs.index_ <= rhs.index_; }
+		friend bool operator>=(const const_iterator& lhs, const const_iterator& rhs) noexcept { return lhs.index_ >= rhs.index_; }
+
+	private:
+		const indexed_span*	container_ = nullptr;
+		difference_type		index_ = 0;
+	};
+	using iterator = const_iterator;
+
+	indexed_span() = default;
+
+	explicit indexed_span(Span data) : data_(data)
+	{
+		Expects(data.size() <= 0xffff);
+		offsets_.clear();
+		for (std::ptrdiff_t offset = 0; offset < data.size(); ) {
+			offsets_.push_back(static_cast<uint_least16_t>(offset));
+			const auto size = iteration_stride(data.subspan(offset));
+			if (size <= 0 || size > data.size() - offset)
+				break; // the element extends to the end of the data
+			offset += size;
+		}
+		offsets_.push_back(static_cast<uint_least16_t>(data.size()));
+	}
+
+	const_iterator begin() const noexcept { return { this, 0 }; }
+	const_iterator end() const noexcept { return { this, static_cast<std::ptrdiff_t>(size()) }; }
+	const_iterator cbegin() const noexcept { return begin(); }
+	const_iterator cend() const noexcept { return end(); }
+
+	size_t size() const noexcept { return offsets_.size() - 1; }
+	bool empty() const noexcept { return size() == 0; }
+
+	Span operator[](size_t index) const noexcept
+	{ return data_.subspan(offsets_[index], offsets_[index + 1] - offsets_[index]); }
+
+	Span at(size_t index) const
+	{
+		Expects(index < size());
+		return (*this)[index];
+	}
+
+	// offset of element index relative to the start of the data
+	std::ptrdiff_t offset(size_t index) const noexcept { return offsets_[index]; }
+
+	Span data() const noexcept { return data_; }
+
+private:
+	Span							data_;
+	std::vector<uint_least16_t>		offsets_{ 0 }; // of each element and the end
+};
+/*******/
+
 template<tssi_size_t iteration_stride>
 class range_span {
 	typedef gsl::span<const char> Span;
@@ -189,6 +349,7 @@ public:
 
 	operator Span() const noexcept { return data_; }
 	Span data() const noexcept { return data_; }
+	indexed_span<iteration_stride> indexed() const { return indexed_span<iteration_stride>(data_); }
 	reference operator[](index_type idx) const noexcept { return _data[idx]; }
 
 	constexpr reference at(index_type idx) const noexcept { return this->operator[](idx); }
@@ -265,6 +426,7 @@ template <class reader, class shift_reference>
 class combined_reader {
 public:
 	typedef typename reader::element_type element_type;
+	static constexpr ptrdiff_t fixed_position = -1;
 
 	element_type operator()(gsl::span<const char> data, size_t index = 0, size_t offset2 = 0) const noexcept
 	{
@@ -276,6 +438,11 @@ public:
 		return reader::at(data, index, offset2 + shift_reference::at(data, 0));
 		// index of shift_reference always == 0
 	}
+
+	static ptrdiff_t position(gsl::span<const char> data, size_t index = 0, size_t offset2 = 0) noexcept
+	{
+		return reader::position(data, index, offset2 + shift_reference::at(data, 0));
+	}
 };
 
 
@@ -289,7 +456,8 @@ public:
 		return at(data, index);
 	}
 
-	static element_type at(gsl::span<const char> data, size_t index = 0) noexcept
+	template <class S>
+	static element_type at(S data, size_t index = 0) noexcept
 	{
 		return (static_cast<unsigned char>(reader::at(data, index)) & (1 << position));
 	}
@@ -308,16 +476,44 @@ public:
 
 	static element_type at(gsl::span<const char> data, size_t index = 0) noexcept
 	{
+		const ptrdiff_t position = reader::position(data, index);
+		if (position >= 0 && position + static_cast<ptrdiff_t>(stride) <= data.size())
+			return load(data.data() + position);
+
+		// partially available, missing bytes read as error_value
 		element_type result{};
 		for (size_t i = 0; i < stride; ++i)
-#ifdef __BIG_ENDIAN
-			result += static_cast<T>(static_cast<unsigned char>(reader::at(data, index, i))) << (i << 3);
-#else // __BIG_ENDIAN
 			result += static_cast<T>(static_cast<unsigned char>(reader::at(data, index, i))) << ((stride - i - 1) << 3);
-#endif // __BIG_ENDIAN
 
 		return result;
 	}
+
+	template <ptrdiff_t fixed_size>
+	static element_type at(validated_span<fixed_size> data, size_t index = 0) noexcept
+	{
+		if (reader::fixed_position >= 0 && reader::fixed_position + static_cast<ptrdiff_t>(stride) <= fixed_size)
+			return load(data.data() + reader::fixed_position);
+		return at(static_cast<gsl::span<const char>>(data), index);
+	}
+
+private:
+	// big-endian value of stride bytes at p, unaligned
+	static element_type load(const char* p) noexcept
+	{
+		if (stride == 1)
+			return static_cast<T>(static_cast<unsigned char>(*p));
+
+		uint64_t value = 0;
+		std::memcpy(&value, p, stride);
+#ifndef TSSI_BIG_ENDIAN
+#ifdef _MSC_VER
+		value = _byteswap_uint64(value);
+#else // _MSC_VER
+		value = __builtin_bswap64(value);
+#endif // _MSC_VER
+#endif // TSSI_BIG_ENDIAN
+		return static_cast<T>(value >> ((8 - stride) << 3));
+	}
 };
 
 template<class value_reader, uint_fast64_t mask_bits, uint_fast64_t shift_right>
@@ -331,13 +527,70 @@ public:
 		return at(data, index);
 	}
 
-	static element_type at(gsl::span<const char> data, size_t index = 0) noexcept
+	template <class S>
+	static element_type at(S data, size_t index = 0) noexcept
 	{
 		return (value_reader::at(data, index) & static_cast<element_type>(mask_bits)) >> shift_right;
 	}
 
 };
 
+namespace {
+	// two BCD digits, 0 if invalid
+	constexpr int_fast32_t bcd_digits(uint_fast64_t hex) noexcept
+	{
+		return ((hex & 0xf0) >> 4) >= 10 || (hex & 0xf) >= 10 ? 0 :
+			static_cast<int_fast32_t>(((hex & 0xf0) >> 4) * 10 + (hex & 0xf));
+	}
+
+	// six BCD digits hhmmss
+	constexpr int_fast32_t bcd_seconds(uint_fast64_t hhmmss) noexcept
+	{
+		return bcd_digits((hhmmss >> 16) & 0xff) * 3600 + bcd_digits((hhmmss >> 8) & 0xff) * 60 + bcd_digits(hhmmss & 0xff);
+	}
+}
+
+/****f* tssi/mjd_utc_seconds
+*  NAME
+*    mjd_utc_seconds -- Converts an ETSI EN 300 468 Annex C time (16 bit modified
+*    Julian date followed by six BCD digits hhmmss UTC) to seconds since
+*    1970-01-01 00:00:00 UTC. Pure arithmetic, independent of the time zone of
+*    the process.
+*  SYNOPSIS
+*/
+constexpr int_fast64_t mjd_utc_seconds(uint_fast64_t value) noexcept
+/*******/
+{
+	// MJD 40587 is 1970-01-01
+	return (static_cast<int_fast64_t>((value >> 24) & 0xffff) - 40587) * 86400 + bcd_seconds(value & 0xffffff);
+}
+
+/****f* tssi/utc_time_point
+*  NAME
+*    utc_time_point -- Converts seconds since 1970-01-01 00:00:00 UTC, e.g. of TIME
+*    values, to a std::chrono::system_clock time point.
+*  SYNOPSIS
+*/
+constexpr std::chrono::system_clock::time_point utc_time_point(int_fast64_t seconds) noexcept
+/*******/
+{
+	return std::chrono::system_clock::time_point(
+		std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::seconds(seconds)));
+}
+
+/****f* tssi/local_offset_seconds
+*  NAME
+*    local_offset_seconds -- Converts a local time offset (polarity, four BCD digits
+*    hhmm decoded to hh * 100 + mm), e.g. of the local_time_offset_descriptor, to
+*    seconds. Local time = UTC + offset.
+*  SYNOPSIS
+*/
+constexpr int_fast32_t local_offset_seconds(bool polarity, uint_fast16_t hhmm) noexcept
+/*******/
+{
+	return (polarity ? -1 : 1) * static_cast<int_fast32_t>((hhmm / 100) * 3600 + (hhmm % 100) * 60);
+}
+
 template<class value_reader>
 class time_convert
 {
@@ -349,36 +602,13 @@ public:
 		return at(data, index);
 	}
 
-	static element_type at(gsl::span<const char> data, size_t index = 0)
+	template <class S>
+	static element_type at(S data, size_t index = 0)
 	{
 		auto value = value_reader::at(data, index);
 		Expects(sizeof(value) >= 8);
-		tm t{};
-
-		t.tm_hour = bcd_dec((value & 0xff0000) >> 16);
-		t.tm_min = bcd_dec((value & 0xff00) >> 8);
-		t.tm_sec = bcd_dec(value & 0xff);
-
-		auto mjd = static_cast<int> (value >> 24);
-		auto y1 = static_cast<int> ((mjd - 15078.2) / 365.25);
-		auto m1 = static_cast<int> ((mjd - 14956.1 - static_cast<int> (y1 * 365.25)) / 30.6001);
-		t.tm_mday = mjd - 14956 - static_cast<int> (y1 * 365.25) - static_cast<int> (m1 * 30.6001);
-		auto k = 0;
-		if (m1 == 14 || m1 == 15) k = 1;
-		t.tm_year = y1 + k;
-		t.tm_mon = m1 - 2 - k * 12;
-
-		return mktime(&t); // no-throw guarantee
+		return static_cast<element_type>(mjd_utc_seconds(value));
 	}
-private:
-	static int bcd_dec(uint_fast64_t hex) noexcept {
-		if (((hex & 0xf0) >> 4) >= 10)
-			return 0;
-		if ((hex & 0xf) >= 10)
-			return 0;
-		return ((hex & 0xf0) >> 4) * 10 + (hex & 0xf);
-	}
-
 };
 
 template<class value_reader>
@@ -392,28 +622,13 @@ public:
 		return at(data, index);
 	}
 
-	static element_type at(gsl::span<const char> data, size_t index = 0)
+	template <class S>
+	static element_type at(S data, size_t index = 0)
 	{
 		auto value = value_reader::at(data, index);
 		Expects(sizeof(value) >= 4);
-
-		element_type result{};
-
-		result += std::chrono::hours(bcd_dec((value & 0xff0000) >> 16));
-		result += std::chrono::minutes(bcd_dec((value & 0xff00) >> 8));
-		result += std::chrono::seconds(bcd_dec(value & 0xff));
-
-		return result;
-	}
-private:
-	static constexpr int bcd_dec(uint_fast64_t hex) noexcept {
-		if (((hex & 0xf0) >> 4) >= 10)
-			return 0;
-		if ((hex & 0xf) >= 10)
-			return 0;
-		return ((hex & 0xf0) >> 4) * 10 + (hex & 0xf);
+		return element_type(bcd_seconds(value));
 	}
-
 };
 
 template<class value_reader, size_t digits = sizeof(value_reader::element_type) * 2>
@@ -427,7 +642,8 @@ public:
 		return at(data, index);
 	}
 
-	static element_type at(gsl::span<const char> data, size_t index = 0) noexcept
+	template <class S>
+	static element_type at(S data, size_t index = 0) noexcept
 	{
 		auto value = value_reader::at(data, index);
 		element_type result{};
@@ -258,7 +258,8 @@ namespace tssi
 
 	/****t* tssi/TIME
 	*  NAME
-	*    TIME -- Converts an ETSI 300 468 Annex C-typed time value to time_c.
+	*    TIME -- Converts an ETSI 300 468 Annex C-typed time value to time_t, seconds
+	*    since 1970-01-01 00:00:00 UTC (see mjd_utc_seconds, utc_time_point).
 	*  SOURCE
 	*/
 	template <class value> 
@@ -305,6 +306,9 @@ namespace tssi
 	*    range_span, range_span_iterator and range for.
 	*    e.g.
 	*       for (auto loop : range_span_ITER(data)) {}
+	*    For random access, index the loop once (see indexed_span):
+	*       auto loops = range_span_ITER(data).indexed();
+	*       auto loop = loops[loops.size() - 1];
 	*  SOURCE
 	*/
 	template <class span, tssi_size_t structure>
@@ -318,17 +322,91 @@ namespace tssi
 #define TSSI_MTD_FAC(classname, functionname) \
 	inline auto functionname(gsl::span<const char> data, size_t index = 0) \
 	noexcept(noexcept(classname::at(data, index))) \
+	{ return classname::at(data, index); } \
+	template <ptrdiff_t fixed_size> \
+	inline auto functionname(validated_span<fixed_size> data, size_t index = 0) \
+	noexcept(noexcept(classname::at(data, index))) \
 	{ return classname::at(data, index); }
 
 /****d* tssi/TSSI_MTD
 *  NAME
-*    TSSI_MTD -- Function factory. Defines functions with the signature
+*    TSSI_MTD -- Function factory. Defines functions with the signatures
 *        inline [return_type] functionname (gsl::span<const char> data, size_t index = 0);
+*        inline [return_type] functionname (validated_span<fixed_size> data, size_t index = 0);
 *  NOTES
 *    The functions does not throw if the underlying reader does not throw.
+*    Fields read from a validated_span within its fixed_size are not bounds checked.
 *  SOURCE
 */
 #define TSSI_MTD(classname, functionname) TSSI_MTD_FAC(TSSI_MTD_ESC classname, functionname)
+/*******/
+
+#define TSSI_STRUCT_EXPAND(x) x
+#define TSSI_STRUCT_CAT_(a, b) a##b
+#define TSSI_STRUCT_CAT(a, b) TSSI_STRUCT_CAT_(a, b)
+#define TSSI_STRUCT_COUNT_N(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, _15, _16, N, ...) N
+#define TSSI_STRUCT_COUNT(...) TSSI_STRUCT_EXPAND(TSSI_STRUCT_COUNT_N(__VA_ARGS__, 16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1))
+#define TSSI_STRUCT_EACH_1(m, x, a) m(x, a)
+#define TSSI_STRUCT_EACH_2(m, x, a, ...) m(x, a) TSSI_STRUCT_EXPAND(TSSI_STRUCT_EACH_1(m, x, __VA_ARGS__))
+#define TSSI_STRUCT_EACH_3(m, x, a, ...) m(x, a) TSSI_STRUCT_EXPAND(TSSI_STRUCT_EACH_2(m, x, __VA_ARGS__))
+#define TSSI_STRUCT_EACH_4(m, x, a, ...) m(x, a) TSSI_STRUCT_EXPAND(TSSI_STRUCT_EACH_3(m, x, __VA_ARGS__))
+#define TSSI_STRUCT_EACH_5(m, x, a, ...) m(x, a) TSSI_STRUCT_EXPAND(TSSI_STRUCT_EACH_4(m, x, __VA_ARGS__))
+#define TSSI_STRUCT_EACH_6(m, x, a, ...) m(x, a) TSSI_STRUCT_EXPAND(TSSI_STRUCT_EACH_5(m, x, __VA_ARGS__))
+#define TSSI_STRUCT_EACH_7(m, x, a, ...) m(x, a) TSSI_STRUCT_EXPAND(TSSI_STRUCT_EACH_6(m, x, __VA_ARGS__))
+#define TSSI_STRUCT_EACH_8(m, x, a, ...) m(x, a) TSSI_STRUCT_EXPAND(TSSI_STRUCT_EACH_7(m, x, __VA_ARGS__))
+#define TSSI_STRUCT_EACH_9(m, x, a, ...) m(x, a) TSSI_STRUCT_EXPAND(TSSI_STRUCT_EACH_8(m, x, __VA_ARGS__))
+#define TSSI_STRUCT_EACH_10(m, x, a, ...) m(x, a) TSSI_STRUCT_EXPAND(TSSI_STRUCT_EACH_9(m, x, __VA_ARGS__))
+#define TSSI_STRUCT_EACH_11(m, x, a, ...) m(x, a) TSSI_STRUCT_EXPAND(TSSI_STRUCT_EACH_10(m, x, __VA_ARGS__))
+#define TSSI_STRUCT_EACH_12(m, x, a, ...) m(x, a) TSSI_STRUCT_EXPAND(TSSI_STRUCT_EACH_11(m, x, __VA_ARGS__))
+#define TSSI_STRUCT_EACH_13(m, x, a, ...) m(x, a) TSSI_STRUCT_EXPAND(TSSI_STRUCT_EACH_12(m, x, __VA_ARGS__))
+#define TSSI_STRUCT_EACH_14(m, x, a, ...) m(x, a) TSSI_STRUCT_EXPAND(TSSI_STRUCT_EACH_13(m, x, __VA_ARGS__))
+#define TSSI_STRUCT_EACH_15(m, x, a, ...) m(x, a) TSSI_STRUCT_EXPAND(TSSI_STRUCT_EACH_14(m, x, __VA_ARGS__))
+#define TSSI_STRUCT_EACH_16(m, x, a, ...) m(x, a) TSSI_STRUCT_EXPAND(TSSI_STRUCT_EACH_15(m, x, __VA_ARGS__))
+#define TSSI_STRUCT_EACH(m, x, ...) \
+	TSSI_STRUCT_EXPAND(TSSI_STRUCT_CAT(TSSI_STRUCT_EACH_, TSSI_STRUCT_COUNT(__VA_ARGS__))(m, x, __VA_ARGS__))
+
+// member types are declared outside of the struct, a member must not change the
+// meaning of the function name it is declared by
+#define TSSI_STRUCT_TYPE(structname, field) using field = decltype(field(gsl::span<const char>()));
+#define TSSI_STRUCT_MEMBER(structname, field) structname##_types::field field;
+#define TSSI_STRUCT_READ(structname, field) result.field = field(view, index);
+
+#define TSSI_STRUCT_FAC(structname, fixed_size, ...) \
+	namespace structname##_types { TSSI_STRUCT_EACH(TSSI_STRUCT_TYPE, structname, __VA_ARGS__) } \
+	struct structname { \
+		TSSI_STRUCT_EACH(TSSI_STRUCT_MEMBER, structname, __VA_ARGS__) \
+	}; \
+	inline structname decode_##structname(gsl::span<const char> data, size_t index = 0) \
+	{ \
+		structname result; \
+		if (data.size() >= (fixed_size)) { \
+			const validated_span<(fixed_size)> view(data); \
+			TSSI_STRUCT_EACH(TSSI_STRUCT_READ, structname, __VA_ARGS__) \
+		} \
+		else { \
+			const gsl::span<const char> view = data; \
+			TSSI_STRUCT_EACH(TSSI_STRUCT_READ, structname, __VA_ARGS__) \
+		} \
+		return result; \
+	}
+
+/****d* tssi/TSSI_STRUCT
+*  NAME
+*    TSSI_STRUCT -- Struct factory. Defines a plain struct with a member for each of
+*    the given TSSI_MTD fields of the namespace, and a function reading all of them
+*    in one pass:
+*        struct structname { [return_type] field_1; [return_type] field_2; ... };
+*        inline structname decode_structname(gsl::span<const char> data, size_t index = 0);
+*  NOTES
+*    Fields are read in the order given, list them by offset. If data holds at least
+*    fixed_size bytes, the fields within are read without bounds checks (see
+*    validated_span). Up to 16 fields.
+*    e.g.
+*        for (auto loop : event_info_loop(data)) {
+*            auto event = loop::decode_entry(loop);
+*  SOURCE
+*/
+#define TSSI_STRUCT(structname, fixed_size, fields) TSSI_STRUCT_FAC(structname, fixed_size, TSSI_MTD_ESC fields)
 /*******/
 
 	namespace iso138183 {
@@ -683,6 +761,12 @@ namespace tssi
 				program_map_PID);
 			// }
 			// CRC_32
+
+			TSSI_STRUCT(header, 8,
+				(table_id, section_syntax_indicator, section_length, transport_stream_id, version_number,
+				current_next_indicator, section_number, last_section_number));
+			TSSI_STRUCT(program, 12,
+				(program_number, program_map_PID));
 		}
 		/*******/
 
@@ -750,6 +834,9 @@ namespace tssi
 					descriptors);
 
 				inline ptrdiff_t size(gsl::span<const char> data) noexcept { return ES_info_length(data) + 5; }
+
+				TSSI_STRUCT(entry, 5,
+					(stream_type, elementary_PID, ES_info_length));
 			}
 			// }
 
@@ -757,6 +844,10 @@ namespace tssi
 				program_info_loop);
 
 			// CRC_32
+
+			TSSI_STRUCT(header, 12,
+				(table_id, section_syntax_indicator, section_length, program_number, version_number,
+				current_next_indicator, section_number, last_section_number, PCR_PID, program_info_length));
 		}
 		/*******/
 
@@ -832,6 +923,9 @@ namespace tssi
 					descriptors);
 
 				inline ptrdiff_t size(gsl::span<const char> data) noexcept { return transport_descriptors_length(data) + 6; }
+
+				TSSI_STRUCT(entry, 6,
+					(transport_stream_id, original_network_id, transport_descriptors_length));
 			}
 			// }
 
@@ -840,6 +934,11 @@ namespace tssi
 
 
 			// CRC_32
+
+			TSSI_STRUCT(header, 10,
+				(table_id, section_syntax_indicator, section_length, network_id, version_number,
+				current_next_indicator, section_number, last_section_number, network_descriptors_length,
+				transport_stream_loop_length));
 		}
 		/*******/
 
@@ -886,6 +985,9 @@ namespace tssi
 					descriptors);
 
 				inline ptrdiff_t size(gsl::span<const char> data) noexcept { return transport_descriptors_length(data) + 6; }
+
+				TSSI_STRUCT(entry, 6,
+					(transport_stream_id, original_network_id, transport_descriptors_length));
 			}
 			// }
 
@@ -893,6 +995,11 @@ namespace tssi
 				transport_stream_loop);
 
 			// CRC_32
+
+			TSSI_STRUCT(header, 10,
+				(table_id, section_syntax_indicator, section_length, bouquet_id, version_number,
+				current_next_indicator, section_number, last_section_number, bouquet_descriptors_length,
+				transport_stream_loop_length));
 		}
 		/*******/
 
@@ -940,6 +1047,9 @@ namespace tssi
 
 				inline ptrdiff_t size(gsl::span<const char> data) noexcept { return descriptors_loop_length(data) + 5; }
 
+				TSSI_STRUCT(entry, 5,
+					(service_id, EIT_schedule_flag, EIT_present_following_flag, running_status, free_CA_mode,
+					descriptors_loop_length));
 			}
 			// }
 
@@ -947,6 +1057,10 @@ namespace tssi
 				service_info_loop);
 
 			// CRC_32
+
+			TSSI_STRUCT(header, 11,
+				(table_id, section_syntax_indicator, section_length, transport_stream_id, version_number,
+				current_next_indicator, section_number, last_section_number, original_network_id));
 		}
 		/*******/
 
@@ -1002,6 +1116,8 @@ namespace tssi
 
 				inline ptrdiff_t size(gsl::span<const char> data) noexcept { return descriptors_loop_length(data) + 12; }
 
+				TSSI_STRUCT(entry, 12,
+					(event_id, start_time, duration, running_status, free_CA_mode, descriptors_loop_length));
 			}
 			// }
 
@@ -1009,6 +1125,11 @@ namespace tssi
 				event_info_loop);
 
 			// CRC_32
+
+			TSSI_STRUCT(header, 14,
+				(table_id, section_syntax_indicator, section_length, service_id, version_number,
+				current_next_indicator, section_number, last_section_number, transport_stream_id,
+				original_network_id, segment_last_section_number, last_table_id));
 		}
 		/*******/
 
@@ -1025,6 +1146,9 @@ namespace tssi
 
 			TSSI_MTD((TIME<R40<3>>),
 				UTC_time);
+
+			TSSI_STRUCT(header, 8,
+				(table_id, section_syntax_indicator, section_length, UTC_time));
 		}
 		/*******/
 
@@ -1049,6 +1173,9 @@ namespace tssi
 				descriptors_loop_length);
 			TSSI_MTD((ITER<DAT<10, descriptors_loop_length_t>, descriptor_loop::size>),
 				descriptors);
+
+			TSSI_STRUCT(header, 10,
+				(table_id, section_syntax_indicator, section_length, UTC_time, descriptors_loop_length));
 		}
 		/*******/
 
@@ -2362,6 +2489,18 @@ namespace tssi
 			TSSI_MTD((BCD<R16<2 + 11, 13>, 4>),
 				next_time_offset);
 			// }
+
+			// local time = UTC + offset(data, i) before time_of_change(data, i), + next_offset(data, i) after
+			inline std::chrono::seconds offset(gsl::span<const char> data, size_t index = 0)
+			{
+				return std::chrono::seconds(local_offset_seconds(local_time_offset_polarity(data, index),
+					static_cast<uint_fast16_t>(local_time_offset(data, index))));
+			}
+			inline std::chrono::seconds next_offset(gsl::span<const char> data, size_t index = 0)
+			{
+				return std::chrono::seconds(local_offset_seconds(local_time_offset_polarity(data, index),
+					static_cast<uint_fast16_t>(next_time_offset(data, index))));
+			}
 		}
 		/*******/
 
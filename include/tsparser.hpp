@@ -26,15 +26,24 @@
 
 // convenience
 #include "psiheap.hpp"
+#include "psipool.hpp"
 #include "pesassembler.hpp"
+#include "programfollower.hpp"
+#include "pcrclock.hpp"
+#include "eventcolumns.hpp"
 
 /****h* /tssi
 *  NAME
 *    tssi -- A library for parsing MPEG-2 and DVB Transport Streams.
 *    To start from here, have a look at the modules, or the classes
 *      TSParser
-*      PSIHeap (PSISection)
+*      PSIHeap (PSISection, DescriptorIndex)
+*      PSIPool
 *      PESAssembler
+*      ProgramFollower
+*      PCRClock
+*    and the functions
+*      extract_events (event_columns)
 *****/
 namespace tssi
 {
@@ -47,21 +56,24 @@ namespace tssi
 *  METHODS
 *    pid_reset
 *    pid_parser
+*    pid_commit
 *****/
 template <class _Alloc = std::allocator< char > >
 class TSParser : public ProcessNode {
 public:
 	/****m* TSParser/pid_reset
 	*  NAME
-	*    pid_reset -- Clears all pid to function associations that has been stored. The 
-	*    parser is resetted to its initial state, but it is still able to pick up the
-	*    Transport Stream were it left off.
+	*    pid_reset -- Clears all pid to function associations and pid_commit functions
+	*    that has been stored. The parser is resetted to its initial state, but it is
+	*    still able to pick up the Transport Stream were it left off.
 	*   SYNOPSIS
 	*/
 	void pid_reset() 
 	/*******/
 	{
 		pid_list.clear();
+		all_list.clear();
+		commit_list.clear();
 	}
 	
 	/****m* TSParser/pid_parser
@@ -79,6 +91,33 @@ public:
 		pid_list.push_back(std::make_pair(pids, function));
 	}
 
+	/****m* TSParser/pid_parser
+	*  NAME
+	*    pid_parser -- Link all Pids with a callback (ProcessNode, functor or lambda...)
+	*    The function is called for every packet found in the stream, after the
+	*    functions linked with a Pid list.
+	*   DATA SCOPE
+	*    iso138181::transport_packet
+	*   SYNOPSIS
+	*/
+	void pid_parser(callback_t&& function)
+	/*******/
+	{
+		all_list.push_back(function);
+	}
+
+	/****m* TSParser/pid_commit
+	*  NAME
+	*    pid_commit -- Establish a function called once after every buffer parsed, e.g.
+	*    to commit a PSIHeap in batch mode (see PSIHeap/heap_batch).
+	*   SYNOPSIS
+	*/
+	void pid_commit(std::function< void() >&& function)
+	/*******/
+	{
+		commit_list.push_back(function);
+	}
+
 private:
 	void process(gsl::span<const char> data) {
 		Expects(data.size() >= 752);
@@ -126,6 +165,9 @@ private:
 				filter(data.subspan(i, 188));
 			}
 		}
+
+		for (const auto& function : commit_list)
+			function();
 	}
 
 	void filter(gsl::span<const char> data) {
@@ -136,10 +178,14 @@ private:
 			if (find(pair.first.begin(), pair.first.end(), pid) != pair.first.end())
 				pair.second(data);
 		}
+		for (const auto& function : all_list)
+			function(data);
 	}
 	
 	std::vector<char, _Alloc> packet_buffer;
 	std::list < std::pair<std::vector<uint_fast16_t>, callback_t>> pid_list;
+	std::vector<callback_t> all_list;
+	std::vector<std::function< void() >> commit_list;
 
 };
 